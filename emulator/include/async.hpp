@@ -0,0 +1,78 @@
+#pragma once
+
+#include "types.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "spsc.hpp"
+
+#include <atomic>
+#include <thread>
+
+/**
+ * Runs a CPU+Mem pair on its own (optionally pinned) thread.
+ *
+ * The host only talks to it through two lock-free SPSC rings: commands go in,
+ * events come out, and neither side ever waits on the other. Commands are
+ * handled in order; a RUN is executed in slices so a stop() is noticed quickly.
+ * The CPU and Mem belong to the machine thread while it runs, the host must use
+ * commands (or a SNAPSHOT) to look at them.
+ * */
+struct AsyncMachine {
+	static constexpr u32 RING_SIZE = 256;
+	static constexpr i32 SLICE = 10000; // cycles between two stop checks
+
+	struct Command {
+		enum Type : byte {
+			RUN,		// execute `cycles` cycles
+			POKE,		// write `value` at `address` (inject input)
+			PEEK,		// read the byte at `address` (peeked, devices are left alone)
+			SNAPSHOT,	// copy the registers, and the memory into `target` if given
+		} type;
+		u32 tag;		// returned in the event, to match requests and answers
+		u32 cycles;
+		u16 address;
+		byte value;
+		Mem* target;	// the host must leave it alone until the SNAPSHOT event comes back
+	};
+
+	struct Event {
+		Command::Type type;	// the command this answers
+		u32 tag;
+		u32 cycles;			// RUN: cycles executed
+		byte value;			// PEEK: the byte read
+		u64 total_cycles;	// since start()
+		CPU cpu;			// the registers after the command
+	};
+
+	CPU cpu;
+	Mem memory;
+
+	AsyncMachine() = default;
+	~AsyncMachine();
+
+	AsyncMachine( const AsyncMachine& ) = delete;
+	AsyncMachine& operator=( const AsyncMachine& ) = delete;
+
+	/** starts the machine thread, pinned to `core` unless it is negative */
+	void start( i32 core = -1 );
+	/** stops the machine thread (interrupting a RUN in progress) and joins it */
+	void stop();
+
+	/** never block, false when the ring is full (send) or empty (poll) */
+	bool send( const Command& command );
+	bool poll( Event& event );
+
+	u64 dropped_events() const;
+
+private:
+	SpscRing<Command, RING_SIZE> commands;
+	SpscRing<Event, RING_SIZE> events;
+	std::thread thread;
+	std::atomic<bool> running{false};
+	std::atomic<u64> dropped{0};
+	u64 total_cycles = 0;
+
+	void work( i32 core );
+	void handle( const Command& command );
+	void emit( const Event& event );
+};
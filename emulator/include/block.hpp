@@ -0,0 +1,107 @@
+#pragma once
+
+#include "types.hpp"
+#include "device.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * Disk controller backed by an image file mapped in memory.
+ *
+ * The guest picks a sector, a buffer address and a sector count, then issues a
+ * command. The transfer completes after a scheduled latency (seek plus a cost
+ * per sector) and is a straight copy between the mapping and Mem; STATUS then
+ * reads DONE and, if enabled, the interrupt line is raised.
+ *
+ * The emulator thread must not block on page faults of the mapping: a helper
+ * thread faults the requested sectors in while the latency runs, and reads
+ * ahead of sequential accesses, with a window that doubles up to
+ * MAX_READAHEAD sectors.
+ *
+ * The registers are latched when a command starts, and writes to them (but
+ * CONTROL) are ignored until it completes.
+ * */
+struct BlockDevice : Device {
+	static constexpr u16 SIZE = 0x08;
+	static constexpr u32 SECTOR_SIZE = 256;
+	static constexpr u32 MAX_READAHEAD = 256; // sectors
+
+	enum Register : byte {
+		SECTOR_L, SECTOR_H,
+		ADDRESS_L, ADDRESS_H,	// guest buffer
+		COUNT,					// sectors to transfer
+		COMMAND,
+		STATUS,					// reading it acknowledges DONE
+		CONTROL,
+	};
+
+	enum Command : byte { READ = 0x01, WRITE = 0x02 };
+
+	/** STATUS bits */
+	static constexpr byte BUSY	= 0b00000001;
+	static constexpr byte ERROR	= 0b00000010;
+	static constexpr byte DONE	= 0b10000000;
+	/** CONTROL bits */
+	static constexpr byte IRQ_ENABLE = 0b00000001;
+
+	u64 transfers = 0;
+	std::atomic<u64> prefetched{0}; // sectors faulted in by the helper thread
+
+	/**
+	 * maps the image at `path` (read-only unless `writable`), throws if it cannot;
+	 * `line` is the Mem interrupt line, latencies are in cycles
+	 * */
+	BlockDevice( const std::string& path, bool writable = false, u32 line = 0,
+		u64 seek_cycles = 1000, u64 sector_cycles = 64 );
+	~BlockDevice();
+
+	BlockDevice( const BlockDevice& ) = delete;
+	BlockDevice& operator=( const BlockDevice& ) = delete;
+
+	u32 sectors() const;
+
+	byte read( u16 offset, u64 cycle ) override;
+	void write( u16 offset, byte value, u64 cycle ) override;
+	byte peek( u16 offset ) const override;
+	void on_event( u64 cycle, u32 tag ) override;
+
+private:
+	bool writable;
+	u32 line;
+	u64 seek_cycles;
+	u64 sector_cycles;
+
+	int fd;
+	byte* image;
+	u64 image_size;
+
+	struct Transfer {
+		byte command;
+		u32 sector;
+		u32 count;
+		u16 address;
+	};
+
+	byte registers[SIZE] = {};
+	byte status = 0x00;
+	Transfer transfer = {};		// the command in flight
+	u32 next_sequential = ~0u;	// sector after the last transfer
+	u32 window = 8;				// readahead window, in sectors
+
+	// sectors the helper thread has yet to fault in
+	std::thread helper;
+	std::mutex lock;
+	std::condition_variable wakeup;
+	u32 prefetch_begin = 0;
+	u32 prefetch_end = 0;
+	bool stopping = false;
+
+	void start( byte command, u64 cycle );
+	void complete();
+	void prefetch( u32 begin, u32 end );
+	void work();
+};
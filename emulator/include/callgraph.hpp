@@ -0,0 +1,87 @@
+#pragma once
+
+#include "types.hpp"
+#include "cpu.hpp"
+#include "profiler.hpp"
+
+#include <map>
+#include <ostream>
+#include <vector>
+
+/**
+ * Call graph probe: keeps a shadow call stack on JSR/RTS and attributes the
+ * cycles of every instruction to guest subroutines.
+ *
+ * A frame remembers the stack pointer its return address lives above. RTS,
+ * RTI and TXS pop every frame whose return address is no longer on the
+ * stack, so a routine that drops its return address (PLA/PLA, then RTS to
+ * its caller's caller) or resets the stack unwinds cleanly. An RTS that
+ * pops no frame (an address pushed by hand, "RTS as a jump") is treated as
+ * a jump within the current routine.
+ *
+ * The JSR is charged to the caller and the RTS to the callee. Inclusive
+ * cycles of a recursive routine are counted once, at the outermost
+ * call. Interrupt handlers are charged to the routine they interrupt.
+ * */
+struct CallGraph {
+	static constexpr u32 ROOT = 0x10000; // the code outside any call
+
+	struct Function {
+		u64 calls = 0;
+		u64 inclusive = 0;
+		u64 exclusive = 0;
+		u32 active = 0;	// frames on the shadow stack
+	};
+
+	struct Edge {
+		u64 calls = 0;
+		u64 cycles = 0;	// inclusive cycles of the callee under this caller
+	};
+
+	SymbolTable symbols;
+	u64 max_trace_events = 1000000;	// further calls are left out of the timeline
+	u64 dropped_trace_events = 0;
+
+	void enter( const CPU& cpu, const Mem& memory ) { (void)cpu; (void)memory; }
+	void retire( const CPU& cpu, const Mem& memory, u16 pc, byte opcode, u32 cycles );
+
+	/** pops the frames still open, before reading the results */
+	void close();
+
+	u32 depth() const;
+	const Function& function( u32 address ) const;
+	const Edge& edge( u32 caller, u32 callee ) const;
+
+	/** functions by inclusive cycles, then the edges */
+	void write_report( std::ostream& out ) const;
+	/** graphviz digraph, edges labelled with calls and cycles */
+	void write_dot( std::ostream& out ) const;
+	/** Chrome trace-event JSON (chrome://tracing, Perfetto), one cycle per microsecond */
+	void write_trace( std::ostream& out ) const;
+
+private:
+	struct Frame {
+		u32 function;
+		u32 caller;
+		byte return_sp;	// the stack pointer once the return address is pulled
+		u64 entry;
+	};
+
+	struct Call {
+		u32 function;
+		u64 start;
+		u64 duration;
+		u32 depth;
+	};
+
+	u64 time = 0;	// cycles retired
+	std::vector<Frame> stack;
+	std::map<u32, Function> functions;
+	std::map<std::pair<u32, u32>, Edge> edges;
+	std::vector<Call> trace;
+
+	u32 current() const;
+	void unwind( byte sp );
+	void pop();
+	std::string name( u32 function ) const;
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "types.hpp"
+#include "device.hpp"
+
+#include <string>
+#include <vector>
+
+/**
+ * Serial console: a data and a status register.
+ *
+ * Guest output is appended to a ring buffer and written to the host fd in
+ * large writes: when the buffer fills up, on a newline (if line buffered) or
+ * once the guest has been quiet for `idle_cycles` (a scheduled event), so a
+ * chatty guest costs a syscall per line or per buffer, not per byte.
+ * Guest input comes from a buffer the host fills beforehand with feed().
+ * */
+struct Console : Device {
+	static constexpr u16 SIZE = 0x02;
+
+	enum Register : byte {
+		DATA,	// write: output a byte, read: next input byte (0 when there is none)
+		STATUS,
+	};
+
+	/** STATUS bits */
+	static constexpr byte INPUT_READY	= 0b00000001;
+	static constexpr byte OUTPUT_READY	= 0b00000010; // always set, output never blocks the guest
+
+	u64 bytes_out = 0;
+	u64 flushes = 0;	// write syscalls
+
+	Console( int fd = 1, u32 capacity = 4096, u64 idle_cycles = 10000, bool line_buffered = true );
+	~Console();
+
+	/** queues input for the guest */
+	void feed( const std::string& text );
+	/** writes out what is buffered */
+	void flush();
+	u32 buffered() const;
+
+	byte read( u16 offset, u64 cycle ) override;
+	void write( u16 offset, byte value, u64 cycle ) override;
+	byte peek( u16 offset ) const override;
+	void on_event( u64 cycle, u32 tag ) override;
+
+private:
+	int fd;
+	u64 idle_cycles;
+	bool line_buffered;
+
+	std::vector<byte> ring;
+	u32 head = 0;	// next byte to write out
+	u32 count = 0;
+	u64 last_write = 0;
+	bool idle_pending = false;
+
+	std::string input;
+	u32 input_next = 0;
+};
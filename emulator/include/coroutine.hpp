@@ -0,0 +1,162 @@
+#pragma once
+
+#include "types.hpp"
+#include "memory.hpp"
+#include "device.hpp"
+
+#include <coroutine>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Allocator for coroutine frames, one per system.
+ *
+ * Frames are carved out of 64 KB chunks and recycled through per-size free
+ * lists, so starting and finishing device coroutines never goes to the heap
+ * once the arena has warmed up. Each frame is preceded by its size and a
+ * pointer to its arena so it can be given back from the promise's operator
+ * delete.
+ * */
+struct FrameArena {
+	static constexpr u32 CHUNK_SIZE = 64 * 1024;
+	static constexpr u32 ALIGN = 16;
+	static constexpr u32 SIZE_CLASSES = 256; // frames up to 4 KB are recycled, bigger ones use the heap
+
+	FrameArena();
+	FrameArena( const FrameArena& ) = delete;
+	FrameArena& operator=( const FrameArena& ) = delete;
+	~FrameArena();
+
+	void* allocate( std::size_t size );
+	static void deallocate( void* frame );
+
+	u32 live() const;			// frames in use
+	u64 reserved() const;		// bytes taken from the heap for chunks
+
+private:
+	struct Header { FrameArena* arena; std::size_t size; };
+	struct FreeFrame { FreeFrame* next; };
+
+	std::vector<byte*> chunks;
+	byte* cursor;
+	byte* end;
+	FreeFrame* free_lists[SIZE_CLASSES];
+	u32 frames;
+};
+
+struct CoDevice;
+
+/**
+ * Return type of a device coroutine. The body starts suspended and is run
+ * by CoDevice::start, the frame is allocated from the FrameArena given as
+ * first argument (or from the one of the CoDevice it is a member of).
+ *
+ * The allocation functions are not templates, GCC only pairs those with the
+ * operator delete below. The rest of the arguments (up to six) bind to
+ * Parameter, which ignores them. A coroutine that fits neither overload does
+ * not compile, rather than quietly taking its frame from the heap.
+ * */
+struct DeviceTask {
+	struct promise_type {
+		struct Parameter {
+			Parameter() = default;
+			template<typename T> Parameter( T& ) {}
+		};
+
+		static void* operator new( std::size_t size, FrameArena& arena, Parameter = {}, Parameter = {},
+			Parameter = {}, Parameter = {}, Parameter = {}, Parameter = {} ) { return arena.allocate(size); }
+		static void* operator new( std::size_t size, CoDevice& device, Parameter = {}, Parameter = {},
+			Parameter = {}, Parameter = {}, Parameter = {}, Parameter = {} );
+		static void* operator new( std::size_t size ) = delete;
+		static void operator delete( void* frame ) { FrameArena::deallocate(frame); }
+
+		DeviceTask get_return_object() { return DeviceTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception();
+	};
+
+	std::coroutine_handle<promise_type> handle;
+
+	DeviceTask() = default;
+	explicit DeviceTask( std::coroutine_handle<promise_type> handle ) : handle(handle) {}
+	DeviceTask( DeviceTask&& other ) : handle(other.handle) { other.handle = nullptr; }
+	DeviceTask& operator=( DeviceTask&& other );
+	~DeviceTask();
+
+	bool done() const { return !handle || handle.done(); }
+};
+
+/**
+ * A device written as a coroutine: the body co_awaits a number of cycles,
+ * or the next access to its registers, and runs straight-line between them.
+ *
+ * Waits are Mem events, so the body is resumed by the CPU at an instruction
+ * boundary (or inside the register access itself) and never needs a thread.
+ * Writes that arrive while the body waits for cycles are queued and handed
+ * out by the next access(). Reads must be answered right away: a waiting body
+ * answers with respond(), otherwise the read returns peek().
+ * */
+struct CoDevice : Device {
+	struct Access {
+		enum Type : byte { READ, WRITE, TIMEOUT } type;
+		u16 offset;
+		byte value;
+		u64 cycle;
+	};
+
+	struct Cycles {
+		CoDevice& device;
+		u64 count;
+		bool await_ready() const { return count == 0; }
+		void await_suspend( std::coroutine_handle<> handle );
+		void await_resume() const {}
+	};
+
+	struct NextAccess {
+		CoDevice& device;
+		u64 timeout;
+		bool await_ready() const { return !device.pending.empty(); }
+		void await_suspend( std::coroutine_handle<> handle );
+		Access await_resume();
+	};
+
+	FrameArena* arena;
+	u64 time = 0; // bus time the body was last resumed at
+
+	explicit CoDevice( FrameArena& arena );
+
+	/** runs the body up to its first co_await, throws if the device is not attached */
+	void start( DeviceTask body );
+	bool running() const { return !task.done(); }
+
+	/** awaitables */
+	Cycles cycles( u64 count ) { return Cycles{ *this, count }; }
+	/** the next register access, or a TIMEOUT after `timeout` cycles */
+	NextAccess access( u64 timeout = Mem::NEVER ) { return NextAccess{ *this, timeout }; }
+	/** the value returned by the read being handled */
+	void respond( byte value );
+
+	byte read( u16 offset, u64 cycle ) override;
+	void write( u16 offset, byte value, u64 cycle ) override;
+	void on_event( u64 cycle, u32 tag ) override;
+
+private:
+	enum Wait : byte { NONE, CYCLES, ACCESS };
+
+	DeviceTask task;
+	std::coroutine_handle<> waiting;
+	Wait wait = NONE;
+	u32 generation = 0;	// tag of the event the body waits on, older ones are stale
+	Access current;
+	std::vector<Access> pending;
+	byte reply = 0x00;
+	bool replied = false;
+
+	void suspend( std::coroutine_handle<> handle, Wait kind, u64 until );
+	void resume( u64 cycle );
+};
+
+inline void* DeviceTask::promise_type::operator new( std::size_t size, CoDevice& device, Parameter, Parameter,
+	Parameter, Parameter, Parameter, Parameter ) { return device.arena->allocate(size); }
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "types.hpp"
+#include "device.hpp"
+
+#include <ostream>
+
+/**
+ * Cycle counter and profiling slots the guest can use to time itself.
+ *
+ * COUNTER is the 64-bit bus time, latched when its low byte is read (or LATCH
+ * is written) so the other bytes read the same value: a 32-bit reader reads
+ * COUNTER_0 to COUNTER_3. Writing a slot number to START, and later to STOP,
+ * adds the cycles in between to that slot's histogram, which the host reads.
+ * Both writes see the bus time at the start of their store, so the measure
+ * includes the START store and not the STOP one.
+ * */
+struct CycleCounter : Device {
+	static constexpr u16 SIZE = 0x10;
+	static constexpr u32 SLOTS = 16;
+	static constexpr u32 BUCKETS = 64; // powers of two
+
+	enum Register : byte {
+		COUNTER_0, COUNTER_1, COUNTER_2, COUNTER_3,
+		COUNTER_4, COUNTER_5, COUNTER_6, COUNTER_7,
+		LATCH,
+		START,	// write a slot number
+		STOP,
+	};
+
+	struct Slot {
+		u64 count = 0;
+		u64 total = 0;
+		u64 min = ~0ull;
+		u64 max = 0;
+		u64 buckets[BUCKETS] = {};	// bucket n counts the measures in [2^(n-1), 2^n)
+		u64 started = ~0ull;		// bus time of the open START
+
+		void add( u64 cycles );
+		u64 mean() const;
+		/** the measure under which `fraction` of them fall, to the bucket */
+		u64 percentile( double fraction ) const;
+	};
+
+	u64 unmatched_stops = 0;
+
+	const Slot& slot( u32 index ) const;
+	void reset();
+	/** one line per slot that has measures */
+	void report( std::ostream& out ) const;
+
+	byte read( u16 offset, u64 cycle ) override;
+	void write( u16 offset, byte value, u64 cycle ) override;
+	byte peek( u16 offset ) const override;
+
+private:
+	u64 latched = 0;
+	Slot slots[SLOTS];
+};
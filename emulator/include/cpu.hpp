@@ -3,12 +3,17 @@
 #include "types.hpp"
 #include "memory.hpp"
 
+struct SampleBuffer;
+
 struct CPU {
 	word PC;	// program counter
 	byte SP;	// stack pointer
 	
 	byte A, X, Y; // registers
 
+	u64 clock = 0; // cycles executed so far, the bus time devices see
+	SampleBuffer* samples = nullptr; // set by Sampler::attach, while the CPU is stopped
+
 	union { // processor status
 		byte flags;
 		struct {
@@ -28,6 +33,7 @@ struct CPU {
 
 	/** memory layout constants */
 	static constexpr u16 RESET_VECTOR	= 0xFFFC; // default reset position for PC
+	static constexpr u16 IRQ_VECTOR		= 0xFFFE; // address of the interrupt handler
 	static constexpr u16 STACK			= 0x0100;
 	// the stack goes from 0x0100 to 0x01FF, but starts at 0x01FF and goes down
 
@@ -132,6 +138,11 @@ struct CPU {
 	static constexpr byte INS_JSR_AB	= 0x20;
 	static constexpr byte INS_RTS		= 0x60;
 
+	// interrupts
+	static constexpr byte INS_RTI		= 0x40;
+	static constexpr byte INS_CLI		= 0x58;
+	static constexpr byte INS_SEI		= 0x78;
+
 
 	/** fetch oeprations */
 	byte fetch_byte( i32& cycles, Mem& memory );
@@ -154,6 +165,32 @@ struct CPU {
 	/** execution */
 	void reset( Mem& memory, word pc = RESET_VECTOR );
 	u32 execute( Mem& memory, i32 cycles );
+	/**
+	 * execution with a probe, called around every instruction:
+	 * probe.enter(cpu, memory) before it and
+	 * probe.retire(cpu, memory, pc, opcode, cycles) after it.
+	 * The body is in cpu_impl.hpp, each probe's .cpp instantiates it;
+	 * execute() without one uses NoProbe and costs nothing extra.
+	 * */
+	template<typename Probe>
+	u32 execute( Mem& memory, i32 cycles, Probe& probe );
+	/**
+	 * resumable execution: runs while the budget is positive and takes the used
+	 * cycles out of it. An instruction can overspend, the (negative) remainder is
+	 * left in the budget and paid back by the next call.
+	 * */
+	u32 resume( Mem& memory, i32& budget );
+	/**
+	 * called between instructions once the clock reaches memory.attention:
+	 * records a profiling sample if one was asked for, pays the cycles stolen
+	 * by DMA, delivers the device events that are due and takes a pending
+	 * interrupt. Waking it with nothing due is harmless. Returns whether it
+	 * used cycles.
+	 * */
+	bool service( i32& cycles, Mem& memory );
+	/** takes the sample the Sampler asked for, if any (in sampler.cpp) */
+	void sample( Mem& memory );
+	void interrupt( i32& cycles, Mem& memory, u16 vector );
 
 	/** utility functions */
 	bool test_bit(byte data, u16 position);
@@ -167,3 +204,11 @@ struct CPU {
 	void inspect();
 	void inspect( Mem& memory, u16 stack_start_offset = 0x00, u16 stack_size = 0xFF, u16 step = 8 );
 };
+
+/** the probe that does nothing */
+struct NoProbe {
+	void enter( const CPU& cpu, const Mem& memory ) { (void)cpu; (void)memory; }
+	void retire( const CPU& cpu, const Mem& memory, u16 pc, byte opcode, u32 cycles ) {
+		(void)cpu; (void)memory; (void)pc; (void)opcode; (void)cycles;
+	}
+};
@@ -0,0 +1,660 @@
+#pragma once
+
+#include "types.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+
+#include <iomanip>
+#include <iostream>
+
+/**
+ * Body of CPU::execute with a probe. Only the translation unit of a probe
+ * includes it, and instantiates execute() for that probe (cpu.cpp does it
+ * for NoProbe), so adding a tool does not recompile the CPU.
+ * */
+template<typename Probe>
+u32 CPU::execute( Mem& memory, i32 cycles, Probe& probe ) {
+
+	i32 initial_cycles = cycles;
+
+	while (cycles > 0) {
+		memory.now = clock + (initial_cycles - cycles);
+		if (memory.now >= memory.attention.load(std::memory_order_relaxed) && service(cycles, memory)) continue;
+
+		u16 pc = PC;
+		i32 before = cycles;
+		probe.enter(*this, memory);
+
+		byte opcode = fetch_byte( cycles, memory );
+		switch (opcode) {
+
+			case INS_LDA_IM:
+			{
+				byte value = fetch_byte(cycles, memory);
+				A = value;
+				set_register_status(A);
+			} break;
+
+			case INS_LDA_ZP:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				byte value = read_byte(cycles, zero_page_addr, memory);
+				A = value;
+				set_register_status(A);
+			} break;
+
+			case INS_LDA_ZPX:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				byte addr = zero_page_addr + X; // unsigned overflow wraps around
+				cycles--; // addition takes one cycle
+				byte value = read_byte(cycles, (u16)addr, memory);
+				A = value;
+				set_register_status(A);
+			} break;
+
+			case INS_LDA_AB:
+			{
+				word addr = fetch_word(cycles, memory);
+				A = read_byte(cycles, addr, memory);
+				set_register_status(A);
+			} break;
+
+			case INS_LDA_ABX:
+			{
+				word addr = fetch_word(cycles, memory);
+				// overflow => page has been crossed
+				//if (((word)(addr << 8) >> 8) + X > 0xFF) cycles--;
+				check_page_cross(cycles, addr, X);
+				addr += X;
+				A = read_byte(cycles, addr, memory);
+				set_register_status(A);
+			} break;
+
+			case INS_LDA_ABY:
+			{
+				word addr = fetch_word(cycles, memory);
+				// overflow => page has been crossed
+				//if (((word)(addr << 8) >> 8) + Y > 0xFF) cycles--;
+				check_page_cross(cycles, addr, Y);
+				addr += Y;
+				A = read_byte(cycles, addr, memory);
+				set_register_status(A);
+			} break;
+
+			case INS_LDA_INX:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				zero_page_addr += X;
+				cycles--;
+				word addr = read_word(cycles, (u16)zero_page_addr, memory);
+				byte value = read_byte(cycles, addr, memory);
+				A = value;
+				set_register_status(A);
+			} break;
+
+			case INS_LDA_INY:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				word addr = read_word(cycles, (u16)zero_page_addr, memory);
+				//if (((word)(addr << 8) >> 8) + Y > 0xFF) cycles--;
+				check_page_cross(cycles, addr, Y);
+				addr += Y;
+				byte value = read_byte(cycles, addr, memory);
+				A = value;
+				set_register_status(A);
+			} break;
+
+			case INS_LDX_IM:
+			{
+				byte value = fetch_byte(cycles, memory);
+				X = value;
+				set_register_status(X);
+			} break;
+
+			case INS_LDX_ZP:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				byte value = read_byte(cycles, zero_page_addr, memory);
+				X = value;
+				set_register_status(X);
+			} break;
+
+			case INS_LDX_ZPY:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				zero_page_addr += Y;
+				cycles--;
+				byte value = read_byte(cycles, zero_page_addr, memory);
+				X = value;
+				set_register_status(X);
+			} break;
+
+			case INS_LDX_AB:
+			{
+				word addr = fetch_word(cycles, memory);
+				byte value = read_byte(cycles, addr, memory);
+				X = value;
+				set_register_status(X);
+			} break;
+
+			case INS_LDX_ABY:
+			{
+				word addr = fetch_word(cycles, memory);
+				// overflow => page has been crossed
+				//if (((word)(addr << 8) >> 8) + Y > 0xFF) cycles--;
+				check_page_cross(cycles, addr, Y);
+				addr += Y;
+				X = read_byte(cycles, addr, memory);
+				set_register_status(X);
+			} break;
+
+			case INS_LDY_IM:
+			{
+				byte value = fetch_byte(cycles, memory);
+				Y = value;
+				set_register_status(Y);
+			} break;
+
+			case INS_LDY_ZP:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				byte value = read_byte(cycles, zero_page_addr, memory);
+				Y = value;
+				set_register_status(Y);
+			} break;
+
+			case INS_LDY_ZPX:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				zero_page_addr += X;
+				cycles--;
+				byte value = read_byte(cycles, zero_page_addr, memory);
+				Y = value;
+				set_register_status(Y);
+			} break;
+
+			case INS_LDY_AB:
+			{
+				word addr = fetch_word(cycles, memory);
+				byte value = read_byte(cycles, addr, memory);
+				Y = value;
+				set_register_status(Y);
+			} break;
+
+			case INS_LDY_ABX:
+			{
+				word addr = fetch_word(cycles, memory);
+				// overflow => page has been crossed
+				//if (((word)(addr << 8) >> 8) + X > 0xFF) cycles--;
+				check_page_cross(cycles, addr, X);
+				addr += X;
+				Y = read_byte(cycles, addr, memory);
+				set_register_status(Y);
+			} break;
+
+			case INS_STA_ZP:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				write_byte(cycles, A, zero_page_addr, memory);
+			} break;
+
+			case INS_STA_ZPX:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				zero_page_addr += X;
+				cycles--;
+				write_byte(cycles, A, zero_page_addr, memory);
+			} break;
+
+			case INS_STA_AB:
+			{
+				word addr = fetch_word(cycles, memory);
+				write_byte(cycles, A, addr, memory);
+			} break;
+
+			case INS_STA_ABX:
+			{
+				word addr = fetch_word(cycles, memory);
+				addr += X;
+				cycles--;
+				write_byte(cycles, A, addr, memory);
+			} break;
+
+			case INS_STA_ABY:
+			{
+				word addr = fetch_word(cycles, memory);
+				addr += Y;
+				cycles--;
+				write_byte(cycles, A, addr, memory);
+			} break;
+
+			case INS_STA_INX:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				zero_page_addr += X;
+				cycles--;
+				word addr = read_word(cycles, zero_page_addr, memory);
+				write_byte(cycles, A, addr, memory);
+			} break;
+
+			case INS_STA_INY:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				word addr = read_word(cycles, zero_page_addr, memory);
+				//if (((word)(addr << 8) >> 8) + Y > 0xFF) cycles--;
+				check_page_cross(cycles, addr, Y);
+				addr += Y;
+				write_byte(cycles, A, addr, memory);
+			} break;
+
+			case INS_STX_ZP:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				write_byte(cycles, X, zero_page_addr, memory);
+			} break;
+
+			case INS_STX_ZPY:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				zero_page_addr += Y;
+				cycles--;
+				write_byte(cycles, X, zero_page_addr, memory);
+			} break;
+
+			case INS_STX_AB:
+			{
+				word addr = fetch_word(cycles, memory);
+				write_byte(cycles, X, addr, memory);
+			} break;
+
+			case INS_STY_ZP:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				write_byte(cycles, Y, zero_page_addr, memory);
+			} break;
+
+			case INS_STY_ZPX:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				zero_page_addr += X;
+				cycles--;
+				write_byte(cycles, Y, zero_page_addr, memory);
+			} break;
+
+			case INS_STY_AB:
+			{
+				word addr = fetch_word(cycles, memory);
+				write_byte(cycles, Y, addr, memory);
+			} break;
+
+			case INS_TAX:
+			{
+				X = A;
+				set_register_status(X);
+			} break;
+
+			case INS_TAY:
+			{
+				Y = A;
+				set_register_status(Y);
+			} break;
+
+			case INS_TXA:
+			{
+				A = X;
+				set_register_status(A);
+			} break;
+
+			case INS_TYA:
+			{
+				A = Y;
+				set_register_status(A);
+			} break;
+
+			case INS_TSX:
+			{
+				X = SP;
+				set_register_status(X);
+			} break;
+
+			case INS_TXS:
+			{
+				SP = X;
+			} break;
+
+			case INS_PHA:
+			{
+				push_byte(cycles, A, memory);
+			} break;
+
+			case INS_PLA:
+			{
+				A = pull_byte(cycles, memory);
+				cycles--; // idk where the 4th cycle comes from...
+				set_register_status(A);
+			} break;
+
+			case INS_PHP:
+			{
+				push_byte(cycles, flags, memory);
+			} break;
+
+			case INS_PLP:
+			{
+				flags = pull_byte(cycles, memory);
+				cycles--; // idk where the 4th cycle comes from...
+				if (memory.irq()) memory.wake(0);
+			} break;
+
+			case INS_AND_IM:
+			{
+				byte mask = fetch_byte(cycles, memory);
+				A &= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_AND_ZP:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				byte mask = read_byte(cycles, zero_page_addr, memory);
+				A &= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_AND_ZPX:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				zero_page_addr += X;
+				cycles--;
+				byte mask = read_byte(cycles, zero_page_addr, memory);
+				A &= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_AND_AB:
+			{
+				word addr = fetch_word(cycles, memory);
+				byte mask = read_byte(cycles, addr, memory);
+				A &= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_AND_ABX:
+			{
+				word addr = fetch_word(cycles, memory);
+				check_page_cross(cycles, addr, X);
+				addr += X;
+				byte mask = read_byte(cycles, addr, memory);
+				A &= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_AND_ABY:
+			{
+				word addr = fetch_word(cycles, memory);
+				check_page_cross(cycles, addr, Y);
+				addr += Y;
+				byte mask = read_byte(cycles, addr, memory);
+				A &= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_AND_INX:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				zero_page_addr += X;
+				cycles--;
+				word addr = read_word(cycles, zero_page_addr, memory);
+				byte mask = read_byte(cycles, addr, memory);
+				A &= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_AND_INY:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				word addr = read_word(cycles, zero_page_addr, memory);
+				check_page_cross(cycles, addr, Y);
+				addr += Y;
+				byte mask = read_byte(cycles, addr, memory);
+				A &= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_EOR_IM:
+			{
+				byte mask = fetch_byte(cycles, memory);
+				A ^= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_EOR_ZP:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				byte mask = read_byte(cycles, zero_page_addr, memory);
+				A ^= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_EOR_ZPX:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				zero_page_addr += X;
+				cycles--;
+				byte mask = read_byte(cycles, zero_page_addr, memory);
+				A ^= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_EOR_AB:
+			{
+				word addr = fetch_word(cycles, memory);
+				byte mask = read_byte(cycles, addr, memory);
+				A ^= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_EOR_ABX:
+			{
+				word addr = fetch_word(cycles, memory);
+				check_page_cross(cycles, addr, X);
+				addr += X;
+				byte mask = read_byte(cycles, addr, memory);
+				A ^= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_EOR_ABY:
+			{
+				word addr = fetch_word(cycles, memory);
+				check_page_cross(cycles, addr, Y);
+				addr += Y;
+				byte mask = read_byte(cycles, addr, memory);
+				A ^= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_EOR_INX:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				zero_page_addr += X;
+				cycles--;
+				word addr = read_word(cycles, zero_page_addr, memory);
+				byte mask = read_byte(cycles, addr, memory);
+				A ^= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_EOR_INY:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				word addr = read_word(cycles, zero_page_addr, memory);
+				check_page_cross(cycles, addr, Y);
+				addr += Y;
+				byte mask = read_byte(cycles, addr, memory);
+				A ^= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_ORA_IM:
+			{
+				byte mask = fetch_byte(cycles, memory);
+				A |= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_ORA_ZP:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				byte mask = read_byte(cycles, zero_page_addr, memory);
+				A |= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_ORA_ZPX:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				zero_page_addr += X;
+				cycles--;
+				byte mask = read_byte(cycles, zero_page_addr, memory);
+				A |= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_ORA_AB:
+			{
+				word addr = fetch_word(cycles, memory);
+				byte mask = read_byte(cycles, addr, memory);
+				A |= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_ORA_ABX:
+			{
+				word addr = fetch_word(cycles, memory);
+				check_page_cross(cycles, addr, X);
+				addr += X;
+				byte mask = read_byte(cycles, addr, memory);
+				A |= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_ORA_ABY:
+			{
+				word addr = fetch_word(cycles, memory);
+				check_page_cross(cycles, addr, Y);
+				addr += Y;
+				byte mask = read_byte(cycles, addr, memory);
+				A |= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_ORA_INX:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				zero_page_addr += X;
+				cycles--;
+				word addr = read_word(cycles, zero_page_addr, memory);
+				byte mask = read_byte(cycles, addr, memory);
+				A |= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_ORA_INY:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				word addr = read_word(cycles, zero_page_addr, memory);
+				check_page_cross(cycles, addr, Y);
+				addr += Y;
+				byte mask = read_byte(cycles, addr, memory);
+				A |= mask;
+				set_register_status(A);
+			} break;
+
+			case INS_BIT_ZP:
+			{
+				byte zero_page_addr = fetch_byte(cycles, memory);
+				byte mask = read_byte(cycles, zero_page_addr, memory);
+				byte res = (A & mask);
+				Z = !!!res;
+				V = test_bit(mask, 6);
+				N = test_bit(mask, 7);
+			} break;
+
+			case INS_BIT_AB:
+			{
+				word addr = fetch_word(cycles, memory);
+				byte mask = read_byte(cycles, addr, memory);
+				byte res = (A & mask);
+				Z = !!!res;
+				V = test_bit(mask, 6);
+				N = test_bit(mask, 7);
+			} break;
+
+			case INS_JMP_AB:
+			{
+				word addr = fetch_word(cycles, memory);
+				PC = addr;
+			} break;
+
+			case INS_JMP_IN:
+			{
+				// check the reference on compatibility with implementing a bug with this instruction
+				word addr = fetch_word(cycles, memory);
+				word target_addr = read_word(cycles, addr, memory);
+				PC = target_addr;
+			} break;
+
+			case INS_JSR_AB:
+			{
+				word sub_addr = fetch_word(cycles, memory);
+				push_word(cycles, PC - 1, memory);
+				PC = sub_addr;
+			} break;
+
+			case INS_RTS:
+			{
+				PC = pull_word(cycles, memory);
+				cycles--;
+			} break;
+
+			case INS_RTI:
+			{
+				// 6 cycles: the return address is pulled right after the status
+				flags = pull_byte(cycles, memory);
+				SP++;
+				PC = read_word(cycles, STACK + SP, memory);
+				SP++;
+				cycles--;
+				if (memory.irq()) memory.wake(0); // I may have been cleared
+			} break;
+
+			case INS_CLI:
+			{
+				I = 0;
+				cycles--;
+				if (memory.irq()) memory.wake(0);
+			} break;
+
+			case INS_SEI:
+			{
+				I = 1;
+				cycles--;
+			} break;
+
+			default:
+			{
+				// printf("Unknown instruction 0x%04x at 0x%04x\n", opcode, cpu->PC);
+				std::cout << "Unknown instruction 0x"
+					<< std::setfill('0') << std::setw(2) << std::hex << (u16)opcode << " at 0x"
+					<< std::setfill('0') << std::setw(4) << std::hex << PC << "." << std::endl;
+			} break;
+		}
+
+		probe.retire(*this, memory, pc, opcode, before - cycles);
+	}
+
+	clock += initial_cycles - cycles;
+	return initial_cycles - cycles;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "types.hpp"
+
+enum AddressingMode : byte {
+	IMPLIED,
+	IMMEDIATE,
+	ZERO_PAGE,
+	ZERO_PAGE_X,
+	ZERO_PAGE_Y,
+	ABSOLUTE,
+	ABSOLUTE_X,
+	ABSOLUTE_Y,
+	INDIRECT,
+	INDEXED_INDIRECT,	// (in,X)
+	INDIRECT_INDEXED,	// (in),Y
+};
+
+/** static description of an opcode, as CPU::execute implements it */
+struct OpInfo {
+	const char* name;		// nullptr for opcodes the CPU does not know
+	AddressingMode mode;
+	byte length;			// bytes, opcode included
+	byte cycles;			// without the page cross penalty
+};
+
+/**
+ * the table is static and shared by every instance; CPU::execute interprets
+ * the opcode directly and keeps no decoded or translated code of its own
+ * */
+const OpInfo& op_info( byte opcode );
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "types.hpp"
+#include "memory.hpp"
+
+/**
+ * A memory mapped device.
+ *
+ * Devices are not ticked by the CPU. They run lazily: whenever the CPU touches
+ * their registers, or an event they scheduled comes due, they are first told to
+ * catch up to the current bus time, and compute whatever happened since the
+ * last time arithmetically. A device that needs to act at a given time (an
+ * interrupt, a transfer completing) schedules an event instead of polling.
+ * */
+struct Device {
+	Mem* bus = nullptr;	// set by Mem::attach
+	u16 base = 0;
+	u32 size = 0;
+
+	virtual ~Device() = default;
+
+	/** brings the device state up to `cycle` */
+	virtual void catch_up( u64 cycle ) { (void)cycle; }
+
+	/** register accesses, `offset` is relative to `base` */
+	virtual byte read( u16 offset, u64 cycle ) = 0;
+	virtual void write( u16 offset, byte value, u64 cycle ) = 0;
+	/** the register value without the side effects of a read */
+	virtual byte peek( u16 offset ) const { (void)offset; return 0x00; }
+
+	/** an event scheduled with Mem::schedule is due */
+	virtual void on_event( u64 cycle, u32 tag ) { (void)cycle; (void)tag; }
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "types.hpp"
+#include "device.hpp"
+
+/**
+ * DMA controller: copies `length` bytes from `source` to `destination`.
+ *
+ * The copy itself is done at once when the guest starts it, as one memmove on
+ * the Mem backing when both ranges are plain RAM. The CPU is then stalled for
+ * the cycles the transfer would take on the bus (it steals them at the next
+ * instruction boundary), and DONE, with the interrupt, comes when they are over.
+ * A fixed source or destination (a device data register) is accessed once
+ * per byte instead.
+ * */
+struct Dma : Device {
+	static constexpr u16 SIZE = 0x08;
+
+	enum Register : byte {
+		SOURCE_L, SOURCE_H,
+		DESTINATION_L, DESTINATION_H,
+		LENGTH_L, LENGTH_H,
+		CONTROL,	// writing START starts a transfer
+		STATUS,		// reading it acknowledges DONE
+	};
+
+	/** CONTROL bits */
+	static constexpr byte START				= 0b00000001;
+	static constexpr byte IRQ_ENABLE		= 0b00000010;
+	static constexpr byte SOURCE_FIXED		= 0b00000100;
+	static constexpr byte DESTINATION_FIXED	= 0b00001000;
+	/** STATUS bits */
+	static constexpr byte BUSY	= 0b00000001;
+	static constexpr byte DONE	= 0b10000000;
+
+	u64 transfers = 0;
+	u64 bytes = 0;
+
+	/** `line` is the Mem interrupt line, a byte costs the CPU `cycles_per_byte` (a read and a write) */
+	explicit Dma( u32 line = 0, u32 cycles_per_byte = 2 );
+
+	byte read( u16 offset, u64 cycle ) override;
+	void write( u16 offset, byte value, u64 cycle ) override;
+	byte peek( u16 offset ) const override;
+	void on_event( u64 cycle, u32 tag ) override;
+
+private:
+	u32 line;
+	u32 cycles_per_byte;
+	byte registers[SIZE] = {};
+	byte status = 0x00;
+
+	void start( u64 cycle );
+};
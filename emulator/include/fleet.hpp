@@ -0,0 +1,79 @@
+#pragma once
+
+#include "types.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * Runs many independent CPU+Mem instances over a pool of worker threads.
+ *
+ * Every instance is executed in quanta of `quantum` cycles and then put back
+ * on the queue of the worker that ran it. A worker pops from the front of its
+ * own queue and, when that is empty, steals from the back of another worker's
+ * queue, so long jobs spread over idle workers without a central lock.
+ * */
+struct Fleet {
+	static constexpr u32 CACHE_LINE = 64;
+
+	/** an instance stops as soon as this returns true (checked after every quantum) */
+	typedef std::function<bool( const CPU&, const Mem& )> StopCondition;
+
+	/**
+	 * the hot part (registers and counters) starts on its own cache line so that
+	 * two workers never write to the same line, the memory follows it
+	 * */
+	struct alignas(CACHE_LINE) Instance {
+		CPU cpu;
+		bool done = false;
+		u32 quanta = 0;
+		u64 cycles = 0;		 // cycles executed so far
+		u64 cycle_limit = 0; // stop after this many cycles, 0 means no limit
+		StopCondition stop;
+
+		Mem memory;
+	};
+
+	struct Stats {
+		u64 cycles = 0;		// cycles executed by all the instances
+		u64 quanta = 0;		// number of execute() calls
+		u64 steals = 0;		// quanta taken from another worker's queue
+		u32 finished = 0;	// instances that reached their stop condition or limit
+	};
+
+	/** `quantum` is the cycles of a slice, it must be positive (throws otherwise) */
+	Fleet( u32 workers = 0, i32 quantum = 10000 );
+
+	/** adds a new instance and returns its id, the caller loads the program */
+	u32 add( StopCondition stop = nullptr, u64 cycle_limit = 0 );
+
+	Instance& instance( u32 id );
+	u32 size() const;
+
+	/** runs every unfinished instance until it stops, blocks until all are done */
+	Stats run();
+
+private:
+	struct alignas(CACHE_LINE) Worker {
+		std::mutex lock;
+		std::deque<u32> jobs;
+		Stats stats;
+	};
+
+	u32 worker_count;
+	i32 quantum;
+	std::vector<std::unique_ptr<Instance>> instances;
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::atomic<u32> remaining;
+
+	bool pop( u32 worker, u32& id );
+	bool steal( u32 thief, u32& id );
+	void work( u32 worker );
+	bool step( Instance& instance, Stats& stats );
+};
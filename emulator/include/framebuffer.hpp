@@ -0,0 +1,96 @@
+#pragma once
+
+#include "types.hpp"
+#include "device.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * 8 bits per pixel (RGB 3-3-2) framebuffer over a window of the address space.
+ *
+ * Guest writes that change a pixel mark its 8x8 tile dirty. end_frame() (called
+ * by the host once per frame, e.g. from a Pacer frame handler) turns the dirty
+ * tiles into rectangles, copies just those pixels and hands them to a
+ * background thread, which appends them to a raw stream and/or writes the
+ * frame as a PPM image. Frames where nothing changed cost nothing.
+ *
+ * The raw stream is a sequence of rectangles: a RectHeader then w * h pixels.
+ * */
+struct Framebuffer : Device {
+	static constexpr u32 TILE = 8;
+
+	struct Rect {
+		u16 x, y, w, h;
+	};
+
+	struct RectHeader {
+		u32 frame;
+		Rect rect;
+	};
+
+	u64 frames = 0;	// frames that had changes
+	u64 rects = 0;
+
+	/**
+	 * width and height are multiples of TILE (throws otherwise), width * height
+	 * a multiple of Mem::PAGE_SIZE
+	 * */
+	Framebuffer( u16 width, u16 height );
+	~Framebuffer();
+
+	Framebuffer( const Framebuffer& ) = delete;
+	Framebuffer& operator=( const Framebuffer& ) = delete;
+
+	u16 width() const;
+	u16 height() const;
+	const byte* pixels() const;
+
+	/** outputs, set before the first frame */
+	void stream_to( int fd );
+	/** writes `prefix` + frame number + ".ppm" for every frame with changes */
+	void dump_ppm( const std::string& prefix );
+
+	/** ends the frame `number`, returns the rectangles queued for the encoder */
+	u32 end_frame( u32 number );
+	/** waits for the encoder to write out every queued frame */
+	void flush();
+
+	static void rgb( byte pixel, byte out[3] );
+
+	byte read( u16 offset, u64 cycle ) override;
+	void write( u16 offset, byte value, u64 cycle ) override;
+	byte peek( u16 offset ) const override;
+
+private:
+	struct Frame {
+		u32 number;
+		std::vector<Rect> rects;
+		std::vector<byte> data;	// the pixels of each rectangle, row by row
+	};
+
+	u16 columns, rows;			// in pixels
+	u16 tile_columns, tile_rows;
+	std::vector<byte> screen;
+	std::vector<byte> dirty;	// one flag per tile
+
+	int stream_fd = -1;
+	std::string ppm_prefix;
+
+	// encoder thread
+	std::thread encoder;
+	std::mutex lock;
+	std::condition_variable wakeup;
+	std::condition_variable idle;
+	std::deque<Frame> queue;
+	bool encoding = false;
+	bool stopping = false;
+	std::vector<byte> image;	// the encoder's copy of the screen
+
+	void work();
+	void encode( const Frame& frame );
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "types.hpp"
+#include "cpu.hpp"
+#include "decode.hpp"
+
+#include <ostream>
+#include <vector>
+
+/**
+ * Memory access heatmap, as a probe for CPU::execute: reads, writes and
+ * instruction fetches per 256-byte page, and optionally per byte.
+ *
+ * The accesses of an instruction are worked out before it runs, from its
+ * op_info addressing mode, its operands and the registers (peeked, so device
+ * registers see no extra reads). Stack traffic is counted by opcode; the
+ * pushes of interrupt entry happen outside the probe and are not counted.
+ *
+ * A written byte stays "fresh" until it is fetched: an instruction with a
+ * fresh byte counts as fresh code, which is how self-modifying code (and
+ * code loaded by the guest) shows up.
+ * */
+struct MemoryHeatmap {
+	struct Counts {
+		u64 reads = 0;
+		u64 writes = 0;
+		u64 fetches = 0;	// instruction bytes
+		u64 fresh = 0;		// instructions executed with a byte written since it was last fetched
+	};
+
+	/** `per_byte` also keeps counts for every address (64K Counts) */
+	explicit MemoryHeatmap( bool per_byte = false );
+
+	void enter( const CPU& cpu, const Mem& memory );
+	void retire( const CPU& cpu, const Mem& memory, u16 pc, byte opcode, u32 cycles ) {
+		(void)cpu; (void)memory; (void)pc; (void)opcode; (void)cycles;
+	}
+
+	const Counts& page( byte page ) const { return pages[page]; }
+	/** all zero unless per byte counts are kept */
+	const Counts& at( u16 address ) const;
+	u64 fresh_instructions() const { return fresh; }
+	void reset();
+
+	/** one 16x16 grid of pages for each kind of access, log scaled */
+	void write_heatmap( std::ostream& out ) const;
+	/** "page,reads,writes,fetches,fresh" for the pages that were touched, then the addresses if kept */
+	void write_csv( std::ostream& out ) const;
+
+private:
+	std::vector<Counts> pages;
+	std::vector<Counts> bytes;
+	std::vector<byte> written;	// one flag per address, set by writes, cleared by fetches
+	u64 fresh = 0;
+
+	void read( u16 address );
+	void write( u16 address );
+	void fetch( u16 pc, byte length );
+};
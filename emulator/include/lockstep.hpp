@@ -0,0 +1,61 @@
+#pragma once
+
+#include "types.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+
+/**
+ * Structure-of-arrays CPU: the registers of up to MAX_LANES instances, one
+ * lane each, executed in lockstep.
+ *
+ * Every step picks the lanes that sit on the lowest PC and whose code bytes at
+ * that PC are identical. If the instruction has a lane kernel, it runs on all of
+ * them at once (the kernels are fixed-width loops over the lane arrays, which
+ * the compiler turns into vector code); otherwise each of those lanes is peeled
+ * out and runs the instruction through the scalar CPU::execute. Lanes on a
+ * different PC wait, and join again as soon as their PC matches. A lane whose
+ * Mem wants attention (a device event or an interrupt is due) is peeled too,
+ * so CPU::service runs for it exactly where it would in a scalar run.
+ *
+ * The results are the same as running every lane through CPU::execute with the
+ * same budget.
+ * */
+struct LockstepCPU {
+	static constexpr u32 MAX_LANES = 32;
+
+	alignas(64) word PC[MAX_LANES];
+	alignas(64) byte SP[MAX_LANES];
+	alignas(64) byte A[MAX_LANES];
+	alignas(64) byte X[MAX_LANES];
+	alignas(64) byte Y[MAX_LANES];
+	alignas(64) byte flags[MAX_LANES];
+	alignas(64) u64 clock[MAX_LANES];	// bus time of each lane, see CPU::clock
+
+	alignas(64) i32 budget[MAX_LANES];	// cycles left in the current execute()
+	alignas(64) u32 used[MAX_LANES];	// cycles used in the current execute()
+
+	Mem* memory[MAX_LANES];
+	u32 lanes = 0;
+
+	u64 vector_steps = 0;	// instructions run by a lane kernel
+	u64 scalar_steps = 0;	// instructions run by a peeled lane
+
+	/** copies a scalar CPU into the given lane, which will run on `memory` */
+	void load( u32 lane, const CPU& cpu, Mem& memory );
+	/** copies a lane back to a scalar CPU */
+	CPU get( u32 lane ) const;
+
+	/** runs every lane for (at least) the given cycles, see CPU::execute */
+	void execute( i32 cycles );
+
+private:
+	bool step_vector( byte opcode, byte lo, byte hi, const bool* mask );
+	void step_scalar( u32 lane );
+
+	void retire( const bool* mask, word length, i32 cycles );
+	void set_register_status( const byte* reg, const bool* mask );
+	void load_immediate( byte* reg, byte value, const bool* mask );
+	void load_absolute( byte* reg, word addr, const bool* mask );
+	void store_absolute( const byte* reg, word addr, const bool* mask );
+	void transfer( byte* to, const byte* from, const bool* mask );
+};
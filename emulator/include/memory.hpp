@@ -2,14 +2,163 @@
 
 #include "types.hpp"
 
+#include <atomic>
+#include <vector>
+
+struct Device;
+
+/**
+ * 64 KB address space made of 256 pages of 256 bytes.
+ *
+ * Every page is either private RAM in `memory`, or mapped to a shared buffer
+ * (the same firmware mapped into many instances). A shared page is ROM, where
+ * guest writes are dropped, copy-on-write, where the first guest write copies
+ * it into the private backing, or SHARED RAM that several Mem read and write.
+ * Shared pages never touch the backing, and initialize() only clears the
+ * private pages that are not zero already, so in lazily committed backing
+ * (a fresh MemPool arena) the pages the guest never writes are never
+ * dirtied. That saves memory at the granularity the backing is committed
+ * at: 4 KB with small pages, 2 MB in a huge page arena, and nothing for
+ * Mem(), which allocates its 64 KB up front.
+ *
+ * Mem is also the bus devices sit on: IO pages are forwarded to a Device, and
+ * devices schedule events on it and raise interrupt lines. The CPU only looks
+ * at any of that when its clock reaches `attention`, so there is no
+ * per-instruction device work (see CPU::service).
+ * */
 struct Mem {
 	static constexpr u32 MAX_MEM = 1024 * 64; // 64 KB
-	byte memory[MAX_MEM];
+	static constexpr u32 PAGE_SIZE = 256;
+	static constexpr u32 PAGES = MAX_MEM / PAGE_SIZE;
+	static constexpr u64 NEVER = ~0ull;
+
+	enum PageMode : byte {
+		RAM,	// private, read/write
+		ROM,	// shared, guest writes are dropped
+		COW,	// shared until the first guest write
+		SHARED,	// shared read/write (RAM on a bus shared by several CPUs)
+		IO,		// memory mapped device
+	};
+
+	struct Event {
+		u64 cycle;
+		Device* device;
+		u32 tag;
+	};
+
+	byte* memory; // MAX_MEM bytes, owned or borrowed
+
+	byte* pages[PAGES];			// where each page is read from
+	PageMode modes[PAGES];
+	const byte* shared[PAGES];	// shared buffer mapped at each page, nullptr for plain RAM
+	Device* devices[PAGES];		// device mapped at each IO page
 
+	u64 now = 0;				// bus time (cycles) of the instruction being executed, kept by the CPU
+	std::atomic<u64> attention{NEVER}; // the CPU calls service() once its clock reaches this
+	std::atomic<u32> irq_lines{0};	// one bit per interrupt source, level triggered, raised from any thread
+	u64 stall = 0;				// cycles taken from the CPU by a bus master (DMA), paid at its next instruction
+	std::vector<Event> events;	// pending device events, unordered (there are only a few)
+
+	/** allocates its own backing on the heap */
+	Mem();
+	/** uses the given MAX_MEM bytes (from a MemPool, a shared segment...) without owning them */
+	explicit Mem( byte* backing );
+	/** copies leave the devices (and their events) behind, IO pages become RAM */
+	Mem( const Mem& other );
+	Mem( Mem&& other );
+	/** copies the contents, the backing stays where it is and devices are detached */
+	Mem& operator=( const Mem& other );
+	~Mem();
+
+	/** clears the RAM and maps the shared pages back in */
 	void initialize();
 
+	/**
+	 * maps `size` bytes of `data` (which must outlive this Mem) at `address`,
+	 * both multiples of PAGE_SIZE (throws otherwise), as ROM or COW pages, or
+	 * SHARED ones (then `data` is written to)
+	 * */
+	void map_shared( u16 address, u32 size, const byte* data, PageMode mode = ROM );
+	/** pages that have private backing */
+	u32 private_pages() const;
+
+	/**
+	 * maps every page back to private RAM and forgets the devices, events,
+	 * interrupts and stall; the contents of the backing are left as they are
+	 * */
+	void unmap_all();
+
+	/**
+	 * maps the device at [base, base + size), the pages it covers become IO
+	 * pages; base must be a multiple of PAGE_SIZE (throws otherwise)
+	 * */
+	void attach( Device& device, u16 base, u32 size );
+
+	/** device events, delivered through Device::on_event once the bus time reaches `cycle` */
+	void schedule( Device& device, u64 cycle, u32 tag = 0 );
+	void cancel( Device& device, u32 tag );
+	u64 next_event() const;
+	/** delivers the events due at `time` */
+	void dispatch( u64 time );
+
+	/** holds the CPU off the bus for `cycles` before its next instruction */
+	void steal( u64 cycles );
+
+	/** can be called from any thread */
+	void raise_irq( u32 line );
+	void clear_irq( u32 line );
+	bool irq() const { return irq_lines.load(std::memory_order_relaxed) != 0; }
+
+	/** asks the CPU to call service() once the bus time reaches `cycle` (can be called from any thread) */
+	void wake( u64 cycle );
+
+	/** guest accesses, these are on the hot path and kept inline */
+	byte read( u16 address ) const {
+		if (modes[address >> 8] == IO) return read_io(address);
+		return pages[address >> 8][address & 0xFF];
+	}
+	void write( u16 address, byte value ) {
+		if (modes[address >> 8] == RAM) pages[address >> 8][address & 0xFF] = value;
+		else write_shared(address, value);
+	}
+	/** read without side effects (a device register is peeked, not read) */
+	byte peek( u16 address ) const;
+
+	/**
+	 * guest-visible block transfers (for DMA), a page at a time and with the
+	 * same rules as read() and write(); the address wraps around at 64 KB
+	 * */
+	void write_block( u16 address, const byte* data, u32 size );
+	void read_block( u16 address, byte* data, u32 size ) const;
+	/** memmove inside the address space, a single one when both ranges are plain RAM */
+	void move_block( u16 destination, u16 source, u32 size );
+
+	/**
+	 * host access to a byte, read like peek(); assigning to it gives a ROM/COW
+	 * page private backing first, so reads never copy a shared page
+	 * */
+	struct Ref {
+		Mem& mem;
+		u16 address;
+
+		operator byte() const { return mem.peek(address); }
+		Ref& operator=( byte value ) { mem.poke(address, value); return *this; }
+		Ref& operator=( const Ref& other ) { return *this = (byte)other; }
+	};
+
 	byte operator[]( u16 address ) const;
-	byte& operator[]( u16 address );
+	Ref operator[]( u16 address ) { return Ref{ *this, address }; }
+	/** host write, into the private backing of a ROM/COW page */
+	void poke( u16 address, byte value );
 
 	void inspect( u16 address, u16 size = 8, u16 step = 8 );
+
+private:
+	bool owned;
+
+	void map_private();
+	void copy_pages( const Mem& other );
+	void privatize( u16 page );
+	void write_shared( u16 address, byte value );
+	byte read_io( u16 address ) const;
 };
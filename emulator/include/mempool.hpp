@@ -0,0 +1,61 @@
+#pragma once
+
+#include "types.hpp"
+#include "memory.hpp"
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+/**
+ * Hands out Mem instances whose backing comes from 2 MB arenas.
+ *
+ * An arena is mapped with MAP_HUGETLB when the host has huge pages reserved,
+ * otherwise it is 2 MB aligned and advised with MADV_HUGEPAGE so transparent
+ * huge pages can back it. Either way the 32 Mem of an arena share one TLB entry.
+ * Arenas are bound to a NUMA node before they are touched, so the memory lives
+ * next to the worker that asked for it.
+ *
+ * acquire() and release() are O(1) (a free list per node). A released Mem is
+ * unmapped (plain private RAM, no devices, events or interrupts) but its
+ * contents are not cleared, CPU::reset() does that.
+ * */
+struct MemPool {
+	static constexpr u64 ARENA_SIZE = 2 * 1024 * 1024;
+	static constexpr u32 MEM_PER_ARENA = ARENA_SIZE / Mem::MAX_MEM;
+	static constexpr i32 CURRENT_NODE = -1;
+
+	MemPool() = default;
+	~MemPool();
+
+	MemPool( const MemPool& ) = delete;
+	MemPool& operator=( const MemPool& ) = delete;
+
+	/** a Mem backed by memory on `node`, the node of the calling thread by default */
+	Mem* acquire( i32 node = CURRENT_NODE );
+	void release( Mem* memory );
+
+	u32 arenas() const;
+	u32 huge_tlb_arenas() const; // arenas backed by reserved (hugetlbfs) pages
+
+	/** NUMA node of the cpu the calling thread runs on */
+	static u32 current_node();
+
+private:
+	struct Slot : Mem {
+		u32 node;
+		Slot( byte* backing, u32 node ) : Mem(backing), node(node) {}
+	};
+
+	struct Arena {
+		void* base;
+		bool huge_tlb;
+	};
+
+	std::mutex lock;
+	std::vector<Arena> arena_list;
+	std::deque<Slot> slots;	// deque: addresses stay valid as it grows
+	std::vector<std::vector<Slot*>> free_lists; // one per node
+
+	void grow( u32 node );
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "types.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+
+#include <functional>
+#include <mutex>
+
+/**
+ * Runs a CPU in real time at the guest clock rate.
+ *
+ * Time is cut in frames (16.67 ms at 60 Hz by default). Every frame has an
+ * absolute deadline computed from the start of the run, and the cycles it runs
+ * are the ones that bring the total up to `clock_hz * elapsed`, so neither a
+ * late frame nor an instruction running over its budget makes the guest drift.
+ * Between frames the thread sleeps with clock_nanosleep(TIMER_ABSTIME) until
+ * `spin` ns before the deadline and then spins on the clock for the rest.
+ * */
+struct Pacer {
+	/** called at the end of every frame, before waiting; return false to stop */
+	typedef std::function<bool( u64 frame )> FrameHandler;
+
+	struct Stats {
+		u64 frames = 0;
+		u64 cycles = 0;
+		u64 late_frames = 0;	// frames whose work ended after their deadline
+		i64 min_lateness = 0;	// ns after the deadline the frame was released (negative: early)
+		i64 max_lateness = 0;
+		i64 total_lateness = 0;
+		u64 total_sleep = 0;	// ns spent sleeping, the rest of the wait was spinning
+
+		double mean_lateness() const;
+	};
+
+	u64 clock_hz;
+	u64 frame_ns;
+	u64 spin_ns;
+
+	Pacer( u64 clock_hz = 1000000, u64 frame_ns = 16666667, u64 spin_ns = 100000 );
+
+	/** runs `frames` frames (0: until the handler says stop) and returns the statistics */
+	Stats run( CPU& cpu, Mem& memory, u64 frames, FrameHandler on_frame = nullptr );
+
+	/** the last run's statistics, safe to read from another thread at any time */
+	Stats stats() const;
+
+	/** ns on CLOCK_MONOTONIC */
+	static u64 now();
+
+private:
+	mutable std::mutex lock; // taken once per frame
+	Stats published;
+
+	void publish( const Stats& stats );
+	void wait_until( u64 deadline, Stats& stats );
+};
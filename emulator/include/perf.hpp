@@ -0,0 +1,117 @@
+#pragma once
+
+#include "types.hpp"
+#include "cpu.hpp"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Host hardware counters (Linux perf_event_open) of the calling thread, user
+ * space only.
+ *
+ * Each counter is opened on its own, so one the PMU does not have, or a host
+ * without a PMU at all (most VMs, containers with perf_event_paranoid set),
+ * only leaves that counter unavailable and the rest still counts. When the
+ * kernel multiplexes counters the values are scaled to the time enabled.
+ * */
+struct HostCounters {
+	enum Counter : byte { CYCLES, INSTRUCTIONS, BRANCH_MISSES, L1D_MISSES, COUNT };
+
+	struct Reading {
+		u64 values[COUNT] = {};
+		bool valid[COUNT] = {};
+		u64 nanoseconds = 0;	// wall clock
+	};
+
+	HostCounters();
+	~HostCounters();
+
+	HostCounters( const HostCounters& ) = delete;
+	HostCounters& operator=( const HostCounters& ) = delete;
+
+	bool available( Counter counter ) const { return fds[counter] >= 0; }
+	bool any() const;
+	/** why the counters that are missing could not be opened */
+	const std::string& error() const { return reason; }
+
+	void start();
+	Reading stop();
+	/** the raw counts, running, for probes that read around single instructions */
+	void read( u64 values[COUNT] ) const;
+
+	static const char* name( Counter counter );
+
+private:
+	int fds[COUNT];
+	std::string reason;
+	u64 started = 0;
+};
+
+/** counts retired instructions, the cheapest probe there is */
+struct InstructionCount {
+	u64 instructions = 0;
+
+	void enter( const CPU& cpu, const Mem& memory ) { (void)cpu; (void)memory; }
+	void retire( const CPU& cpu, const Mem& memory, u16 pc, byte opcode, u32 cycles ) {
+		(void)cpu; (void)memory; (void)pc; (void)opcode; (void)cycles;
+		instructions++;
+	}
+};
+
+/**
+ * Host cost of a run, from measure(): totals and per guest instruction.
+ * */
+struct RunCost {
+	u64 guest_cycles = 0;
+	u64 guest_instructions = 0;
+	HostCounters::Reading host;
+
+	/** host count per guest instruction, -1 when the counter is unavailable */
+	double per_instruction( HostCounters::Counter counter ) const;
+	double nanoseconds_per_instruction() const;
+	void write( std::ostream& out ) const;
+};
+
+/** runs `cycles` of `cpu` under the counters */
+RunCost measure( HostCounters& counters, CPU& cpu, Mem& memory, i32 cycles );
+
+/**
+ * Sampling probe: around one instruction in every `interval`, reads the
+ * counters and charges what the host spent (less the cost of the reads
+ * themselves, calibrated at construction) to the opcode being dispatched.
+ * That tells which opcodes the host mispredicts or misses the cache on;
+ * the counters must have been started.
+ * */
+struct OpcodeCost {
+	struct Totals {
+		u64 samples = 0;
+		u64 values[HostCounters::COUNT] = {};
+	};
+
+	OpcodeCost( HostCounters& counters, u32 interval = 64 );
+
+	void enter( const CPU& cpu, const Mem& memory ) {
+		(void)cpu; (void)memory;
+		if (--countdown == 0) counters.read(before);
+	}
+	void retire( const CPU& cpu, const Mem& memory, u16 pc, byte opcode, u32 cycles ) {
+		(void)cpu; (void)memory; (void)pc; (void)cycles;
+		if (countdown == 0) sample(opcode);
+	}
+
+	const Totals& at( byte opcode ) const { return table[opcode]; }
+	/** opcodes by branch misses per sample, worst first */
+	void write( std::ostream& out ) const;
+
+private:
+	HostCounters& counters;
+	u32 interval;
+	u32 countdown;
+	u64 before[HostCounters::COUNT];
+	u64 overhead[HostCounters::COUNT];
+	std::vector<Totals> table;
+
+	void sample( byte opcode );
+};
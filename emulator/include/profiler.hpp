@@ -0,0 +1,67 @@
+#pragma once
+
+#include "types.hpp"
+#include "cpu.hpp"
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Guest labels, to name addresses in profiles.
+ *
+ * load() reads label files as written by VICE and ld65 (-Ln),
+ * "al 00C000 .label", or one "label = $C000" or "C000 label" per line.
+ * */
+struct SymbolTable {
+	bool load( const std::string& path );
+	void add( u16 address, const std::string& name );
+	u32 size() const;
+
+	/** the closest label at or before `address` (and where it is), nullptr when there is none */
+	const std::string* function( u16 address, u16* start = nullptr ) const;
+	/** "label+0x3", or "$1234" without a label */
+	std::string describe( u16 address ) const;
+
+private:
+	std::map<u16, std::string> labels;
+};
+
+/**
+ * Flat per-PC profile: instructions and cycles retired at every address, in
+ * a 64K-entry table. It is a probe for CPU::execute, so a run without it does
+ * not pay for the counting.
+ * */
+struct Profiler {
+	struct Counters {
+		u64 instructions = 0;
+		u64 cycles = 0;
+	};
+
+	SymbolTable symbols;
+
+	Profiler();
+
+	void enter( const CPU& cpu, const Mem& memory ) { (void)cpu; (void)memory; }
+	void retire( const CPU& cpu, const Mem& memory, u16 pc, byte opcode, u32 cycles ) {
+		(void)cpu; (void)memory; (void)opcode;
+		Counters& counters = table[pc];
+		counters.instructions++;
+		counters.cycles += cycles;
+	}
+
+	const Counters& at( u16 pc ) const;
+	u64 total_cycles() const;
+	void reset();
+	/** the `count` addresses with the most cycles, hottest first */
+	std::vector<u16> hottest( u32 count ) const;
+
+	/** flamegraph.pl input, "function;function+offset cycles" per address */
+	void write_folded( std::ostream& out ) const;
+	/** pprof profile (uncompressed profile.proto), with instruction and cycle samples per address */
+	void write_pprof( std::ostream& out ) const;
+
+private:
+	std::vector<Counters> table;
+};
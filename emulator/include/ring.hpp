@@ -0,0 +1,95 @@
+#pragma once
+
+#include "types.hpp"
+#include "device.hpp"
+
+#include <functional>
+#include <span>
+
+/**
+ * Producer/consumer ring between the guest and the host.
+ *
+ * The payload is a window of guest RAM (private RAM pages, readable() and
+ * writable() throw if it is mapped otherwise), the head and tail counters are
+ * registers. The host works on the payload in place: readable() and
+ * writable() give spans straight into the Mem backing, no byte is copied
+ * through Mem::operator[]. One side produces, the other consumes; both ring
+ * the doorbell to wake the other one up (the host gets a callback, the guest
+ * an interrupt).
+ *
+ * Head and tail are free-running 16-bit counters, the capacity a power of two;
+ * the guest writes its counter low byte first, the value is taken when the
+ * high byte comes. Counters further apart than the capacity count as a full
+ * ring. The host side must run on the thread that runs the CPU (in the
+ * doorbell callback or between two execute() calls).
+ * */
+struct RingDevice : Device {
+	static constexpr u16 SIZE = 0x10;
+
+	enum Direction : byte {
+		TO_HOST,	// the guest produces
+		TO_GUEST,	// the host produces
+	};
+
+	enum Register : byte {
+		HEAD_L, HEAD_H,	// producer counter
+		TAIL_L, TAIL_H,	// consumer counter
+		DOORBELL,		// any write rings the host
+		STATUS,			// reading it acknowledges the host's doorbell
+		CONTROL,
+		BASE_H,			// where the payload is (read only)
+		PAGES,			// its size in pages (read only)
+	};
+
+	/** STATUS bits */
+	static constexpr byte RANG = 0b00000001;
+	/** CONTROL bits */
+	static constexpr byte IRQ_ENABLE = 0b00000001;
+
+	/** the payload, as at most two pieces (the ring may wrap) */
+	struct Spans {
+		std::span<byte> first;
+		std::span<byte> second;
+		u32 size() const { return first.size() + second.size(); }
+	};
+
+	std::function<void( RingDevice& )> on_doorbell;
+	u64 doorbells = 0;	// rung by the guest
+
+	/**
+	 * payload at [base, base + capacity), base a multiple of Mem::PAGE_SIZE and
+	 * capacity a power of two (throws otherwise), `line` is the Mem interrupt line
+	 * */
+	RingDevice( Direction direction, u16 base, u32 capacity, u32 line = 0 );
+
+	u16 head() const;
+	u16 tail() const;
+
+	/** host side, consumer of a TO_HOST ring */
+	Spans readable();
+	void consume( u32 size );
+	/** host side, producer of a TO_GUEST ring */
+	Spans writable();
+	void produce( u32 size );
+	/** interrupts the guest (if it enabled it) */
+	void ring_guest();
+
+	byte read( u16 offset, u64 cycle ) override;
+	void write( u16 offset, byte value, u64 cycle ) override;
+	byte peek( u16 offset ) const override;
+
+private:
+	Direction direction;
+	u16 payload_base;
+	u32 capacity;
+	u32 line;
+
+	u16 head_count = 0;
+	u16 tail_count = 0;
+	byte low_latch = 0x00;
+	byte status = 0x00;
+	byte control = 0x00;
+
+	Spans spans( u16 from, u32 size );
+	u32 filled() const;
+};
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "types.hpp"
+#include "cpu.hpp"
+#include "profiler.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+/**
+ * A sampled guest PC and the call sites found on its stack, innermost first.
+ * */
+struct Sample {
+	static constexpr u32 MAX_DEPTH = 16;
+
+	u16 pc;
+	byte depth;
+	u16 callers[MAX_DEPTH];
+};
+
+/**
+ * Samples of one CPU: a single producer, single consumer ring.
+ *
+ * The CPU thread records into it from CPU::service when `due` is set, the
+ * host drains it from any one thread while the CPU runs. A full ring drops
+ * the sample instead of waiting.
+ * */
+struct SampleBuffer {
+	std::atomic<bool> due{false};	// set by the sampler, taken by the CPU
+
+	/** `capacity` is rounded up to a power of two */
+	explicit SampleBuffer( u32 capacity = 4096 );
+
+	/**
+	 * records the PC, and walks the stack for return addresses: a word on the
+	 * stack is taken for one when the byte it points two below is a JSR
+	 * */
+	void record( const CPU& cpu, const Mem& memory );
+	/** appends the samples recorded so far to `out`, returns how many */
+	u32 drain( std::vector<Sample>& out );
+	u64 dropped() const { return lost.load(std::memory_order_relaxed); }
+
+private:
+	std::vector<Sample> ring;
+	u32 mask;
+	std::atomic<u32> head{0};	// written by the CPU
+	std::atomic<u32> tail{0};	// written by the consumer
+	std::atomic<u64> lost{0};
+};
+
+/**
+ * Statistical profiler: a host thread ticks every `period` microseconds and
+ * asks each attached CPU for a sample, by setting the buffer's `due` flag and
+ * waking its Mem. The CPU takes it on the service() path it already checks
+ * between instructions, so a running CPU pays nothing per instruction, only
+ * a stack walk per tick.
+ *
+ * CPU::samples is a plain pointer the CPU thread reads in service(), so a
+ * CPU is attached and detached while it is stopped (before or between
+ * execute() calls). Once attached it can be left on: the timer thread only
+ * touches the buffer's `due` flag and the Mem's attention.
+ * */
+struct Sampler {
+	explicit Sampler( u32 period = 1000 );
+	~Sampler();
+
+	Sampler( const Sampler& ) = delete;
+	Sampler& operator=( const Sampler& ) = delete;
+
+	/**
+	 * `cpu` records into `buffer` from now on; the three must outlive the
+	 * attachment. Only while `cpu` is not executing, like detach()
+	 * */
+	void attach( CPU& cpu, Mem& memory, SampleBuffer& buffer );
+	void detach( CPU& cpu );
+
+	/** the timer thread */
+	void start();
+	void stop();
+
+	/** one tick by hand */
+	void tick();
+	u64 ticks() const { return count.load(std::memory_order_relaxed); }
+
+private:
+	struct Target {
+		CPU* cpu;
+		Mem* memory;
+		SampleBuffer* buffer;
+	};
+
+	u32 period;
+	std::vector<Target> targets;
+	std::atomic<u64> count{0};
+
+	std::thread timer;
+	std::mutex lock;
+	std::condition_variable wakeup;
+	bool stopping = false;
+
+	void run();
+};
+
+/**
+ * Samples aggregated by stack, named with a SymbolTable.
+ * */
+struct SampleProfile {
+	SymbolTable symbols;
+
+	void add( const std::vector<Sample>& samples );
+	u64 samples() const { return total; }
+	/** samples whose PC is `pc` */
+	u64 at( u16 pc ) const;
+
+	/** flamegraph.pl input, "caller;...;function;function+offset samples" */
+	void write_folded( std::ostream& out ) const;
+
+private:
+	std::map<std::vector<u16>, u64> stacks;	// call sites outermost first, then the PC
+	u64 total = 0;
+
+	std::string function( u16 address ) const;
+};
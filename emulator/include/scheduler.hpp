@@ -0,0 +1,109 @@
+#pragma once
+
+#include "types.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+/**
+ * Cooperative M:N scheduler, multiplexes many low-rate CPU+Mem tasks onto a
+ * few worker threads.
+ *
+ * A task asks for `cycles_per_tick` cycles every `period` nanoseconds. It is
+ * released at the start of every period with a fresh budget and has to spend it
+ * before the end of the period (its deadline). Workers always run the ready task
+ * with the earliest deadline, ties (and tasks without a period, which run
+ * freely) go to the one that has used the fewest cycles so far.
+ *
+ * Tasks run in slices of at most `quantum` cycles through CPU::resume, so
+ * switching task is just returning from it. A parked task (waiting for I/O, for
+ * example) is not scheduled until it is unparked.
+ * */
+struct Scheduler {
+	enum State {
+		READY,		// in the ready queue
+		WAITING,	// budget spent, waiting for the next period
+		RUNNING,
+		PARKED,
+		DONE,
+	};
+
+	struct Task;
+	/** called after every completed tick, outside the scheduler lock; return false to finish the task */
+	typedef std::function<bool( Task& )> TickHandler;
+
+	struct Task {
+		CPU cpu;
+		u32 id;
+		i32 cycles_per_tick;
+		u64 period;			// ns, 0 means free running
+
+		State state = READY;
+		bool park_requested = false;	// park() while RUNNING, resolved by its worker at the end of the slice
+		i32 budget = 0;		// cycles left in the current tick, negative when overspent
+		u64 release = 0;	// ns, start of the current period
+		u64 deadline = 0;	// ns, end of the current period
+		u64 cycles = 0;		// cycles executed so far
+		u64 ticks = 0;		// completed ticks
+		u64 missed = 0;		// ticks completed after their deadline
+		u32 seq = 0;		// invalidates stale queue entries
+		TickHandler on_tick;
+
+		Mem memory;
+	};
+
+	Scheduler( u32 workers = 1, i32 quantum = 1000 );
+
+	/** adds a task, the caller loads the program into task(id) */
+	u32 add( i32 cycles_per_tick, u64 period = 0, TickHandler on_tick = nullptr );
+	Task& task( u32 id );
+	u32 size() const;
+
+	void park( u32 id );
+	void unpark( u32 id );
+
+	/** runs the tasks for `duration` ns of wall time, or until they are all done */
+	void run_for( u64 duration );
+
+	/** ns on the steady clock */
+	static u64 now();
+
+private:
+	struct Entry {
+		u64 key;		// deadline for the ready queue, release for the waiting one
+		u64 cycles;
+		u32 id;
+		u32 seq;
+		bool operator>( const Entry& other ) const {
+			if (key != other.key) return key > other.key;
+			if (cycles != other.cycles) return cycles > other.cycles;
+			return id > other.id;
+		}
+	};
+	typedef std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> Queue;
+
+	u32 worker_count;
+	i32 quantum;
+	std::vector<std::unique_ptr<Task>> tasks;
+	u32 active = 0; // tasks not done
+
+	std::mutex lock;
+	std::condition_variable wakeup;
+	Queue ready;
+	Queue waiting;
+
+	void work( u64 end );
+	void push_ready( Task& task );
+	void push_waiting( Task& task );
+	void replenish( Task& task, u64 release );
+	void release_due( u64 time );
+	bool pop_ready( u32& id );
+	void complete_tick( Task& task, u64 time );
+	bool settle_park( Task& task );
+};
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "types.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+
+#include <atomic>
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * Bounded lock-free multi-producer/multi-consumer ring of u32 values, laid out
+ * in memory the caller provides (a shared mapping, to use it across processes).
+ * Every cell carries a sequence number telling whether it is ready to be
+ * written or read at a given position.
+ *
+ * A push or pop can publish a claim, the position and value it is about to
+ * take, before it takes it. If the process dies halfway, whoever finds the
+ * claim can tell whether the position was taken and finish the operation
+ * with complete_push()/release_pop(), so the ring is not wedged.
+ * */
+struct SharedRing {
+	struct Cell {
+		std::atomic<u32> sequence;
+		std::atomic<u32> value;
+	};
+
+	/** position << 32 | value, NO_CLAIM when there is none */
+	typedef std::atomic<u64> Claim;
+	static constexpr u64 NO_CLAIM = ~0ull;
+	static u32 claim_position( u64 claim ) { return claim >> 32; }
+	static u32 claim_value( u64 claim ) { return (u32)claim; }
+
+	struct alignas(64) Header {
+		u32 mask;
+		alignas(64) std::atomic<u32> head;
+		alignas(64) std::atomic<u32> tail;
+	};
+
+	Header* header = nullptr;
+	Cell* cells = nullptr;
+
+	/** bytes needed by a ring of `capacity` (a power of two) values */
+	static u32 footprint( u32 capacity );
+
+	/** lays the ring out at `at`, must be done once, before any push/pop */
+	void create( void* at, u32 capacity );
+
+	bool push( u32 value, Claim* claim = nullptr );
+	bool pop( u32& value, Claim* claim = nullptr );
+
+	/** whether a push/pop at `position` went past the point of no return */
+	bool pushed( u32 position ) const;
+	bool popped( u32 position ) const;
+	/** finish the push/pop of a claim whose owner died after taking the position */
+	void complete_push( u32 position, u32 value );
+	void release_pop( u32 position );
+};
+
+/**
+ * Runs emulator jobs in forked worker processes.
+ *
+ * The jobs, the job queue and the completion queue all live in one shared
+ * anonymous mapping created before the workers are forked. A job is filled in
+ * place by the supervisor, run in place by a worker and read back in place, so
+ * nothing is copied between processes. A worker that dies takes only its
+ * current job with it: the job comes back FAILED and the worker is respawned.
+ * Workers claim jobs (and hand them back) through ring claims, so a worker
+ * that dies right after popping a job has it queued again, and one that dies
+ * after finishing it has it delivered; collect() drops the duplicates this
+ * can produce.
+ *
+ * Workers are forked once, so a job's Mem must be self-contained: only plain
+ * private RAM pages can be shipped, shared (ROM, COW, SHARED) pages point
+ * into the supervisor's heap and IO pages at its devices. submit() throws on
+ * anything else.
+ *
+ * The supervisor side (acquire/submit/collect/release) is meant to be used by
+ * a single thread.
+ * */
+struct ShardPool {
+	enum Status : u32 {
+		FREE,
+		QUEUED,
+		RUNNING,
+		DONE,
+		FAILED,
+	};
+
+	struct Job {
+		CPU cpu;		// in: initial state, out: state after the run
+		i32 cycles;		// in
+		u32 used;		// out: cycles executed
+		std::atomic<u32> status;
+		std::atomic<u32> worker; // index of the worker running the job
+		u32 ticket;		// set by submit(), tells a result from a duplicate of it
+		byte image[Mem::MAX_MEM];
+		Mem memory;		// in/out, backed by `image`
+
+		Job() : memory(&image[0]) {}
+	};
+
+	/** at most 4096 slots */
+	ShardPool( u32 workers, u32 slots );
+	~ShardPool();
+
+	ShardPool( const ShardPool& ) = delete;
+	ShardPool& operator=( const ShardPool& ) = delete;
+
+	/** a free job slot to fill in, nullptr when all slots are in use */
+	Job* acquire();
+	/** queues a filled in job, throws if its Mem has pages other than private RAM */
+	bool submit( Job* job );
+	/** next DONE or FAILED job, nullptr if there is none and `wait` is false */
+	Job* collect( bool wait = true );
+	/** gives a collected job slot back */
+	void release( Job* job );
+
+	pid_t worker_pid( u32 worker ) const;
+	u32 respawned() const;
+
+private:
+	struct Control {
+		std::atomic<u32> shutdown;
+	};
+
+	// job queue entries are the slot and the low bits of the ticket
+	static constexpr u32 SLOT_BITS = 12;
+	static constexpr u32 SLOT_MASK = (1u << SLOT_BITS) - 1;
+
+	// what each worker is taking off or putting on the queues
+	struct Claims {
+		SharedRing::Claim popping;
+		SharedRing::Claim pushing;
+	};
+
+	void* segment = nullptr;
+	u64 segment_size = 0;
+	Control* control = nullptr;
+	Claims* claims = nullptr;
+	SharedRing jobs_queue;
+	SharedRing done_queue;
+	Job* jobs = nullptr;
+	u32 slots;
+
+	std::vector<pid_t> workers;
+	std::vector<u32> free_slots;
+	std::vector<u32> collected;	// ticket last collected from each slot
+	u32 next_ticket = 1;
+	u32 respawn_count = 0;
+
+	void spawn( u32 worker );
+	void reap();
+	void recover( u32 worker );
+	u32 queue_entry( const Job& job ) const;
+	[[noreturn]] void work( u32 worker );
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <atomic>
+
+/**
+ * Bounded lock-free single-producer/single-consumer ring. Each side keeps a
+ * cached copy of the other side's index and only reloads it when the ring looks
+ * full (or empty), so the common case touches no shared cache line but its own.
+ * */
+template <typename T, u32 CAPACITY>
+struct SpscRing {
+	static_assert((CAPACITY & (CAPACITY - 1)) == 0, "the capacity must be a power of two");
+
+	bool push( const T& value ) {
+		u32 tail = write_index.load(std::memory_order_relaxed);
+		if (tail - cached_read == CAPACITY) {
+			cached_read = read_index.load(std::memory_order_acquire);
+			if (tail - cached_read == CAPACITY) return false;
+		}
+		items[tail & (CAPACITY - 1)] = value;
+		write_index.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop( T& value ) {
+		u32 head = read_index.load(std::memory_order_relaxed);
+		if (head == cached_write) {
+			cached_write = write_index.load(std::memory_order_acquire);
+			if (head == cached_write) return false;
+		}
+		value = items[head & (CAPACITY - 1)];
+		read_index.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const {
+		return read_index.load(std::memory_order_acquire) == write_index.load(std::memory_order_acquire);
+	}
+
+private:
+	// producer side
+	alignas(64) std::atomic<u32> write_index{0};
+	u32 cached_read = 0;
+	// consumer side
+	alignas(64) std::atomic<u32> read_index{0};
+	u32 cached_write = 0;
+
+	alignas(64) T items[CAPACITY] = {};
+};
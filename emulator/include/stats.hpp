@@ -0,0 +1,78 @@
+#pragma once
+
+#include "types.hpp"
+#include "cpu.hpp"
+#include "decode.hpp"
+
+#include <atomic>
+#include <ostream>
+
+/**
+ * Instruction mix and event counters, as a probe for CPU::execute: a run
+ * without it is compiled from the NoProbe instantiation and is the same code
+ * as before.
+ *
+ * The counters are relaxed atomics bumped by their only writer with a plain
+ * load and store (no locked instruction), so another thread can take a
+ * snapshot() at any time while the CPU runs. A snapshot is not a consistent
+ * cut: counters read a few instructions apart may not add up exactly.
+ *
+ * Page cross penalties are the cycles an instruction took beyond its op_info
+ * cost, stack traffic is counted by opcode (interrupt entry, which happens
+ * outside the probe, is not).
+ * */
+struct Statistics {
+	static constexpr u32 MODES = INDIRECT_INDEXED + 1;
+
+	struct Snapshot {
+		u64 instructions = 0;
+		u64 cycles = 0;
+		u64 page_crosses = 0;
+		u64 pushes = 0;		// bytes
+		u64 pulls = 0;
+		u64 unknown = 0;	// opcodes the CPU does not implement
+		u64 opcodes[256] = {};
+		u64 modes[MODES] = {};
+
+		void write( std::ostream& out ) const;
+	};
+
+	Statistics();
+
+	void enter( const CPU& cpu, const Mem& memory ) { (void)cpu; (void)memory; }
+	void retire( const CPU& cpu, const Mem& memory, u16 pc, byte opcode, u32 cycles ) {
+		(void)cpu; (void)memory; (void)pc;
+		const OpInfo& info = op_info(opcode);
+		bump(instructions);
+		bump(this->cycles, cycles);
+		bump(opcodes[opcode]);
+		if (!info.name) {
+			bump(unknown);
+			return;
+		}
+		bump(modes[info.mode]);
+		if (cycles > info.cycles) bump(page_crosses);
+		if (stack[opcode] > 0) bump(pushes, stack[opcode]);
+		else if (stack[opcode] < 0) bump(pulls, -stack[opcode]);
+	}
+
+	/** can be called from any thread */
+	Snapshot snapshot() const;
+	/** only while the CPU is not running */
+	void reset();
+
+private:
+	std::atomic<u64> instructions{0};
+	std::atomic<u64> cycles{0};
+	std::atomic<u64> page_crosses{0};
+	std::atomic<u64> pushes{0};
+	std::atomic<u64> pulls{0};
+	std::atomic<u64> unknown{0};
+	std::atomic<u64> opcodes[256];
+	std::atomic<u64> modes[MODES];
+	signed char stack[256];	// bytes pushed (positive) or pulled by each opcode
+
+	static void bump( std::atomic<u64>& counter, u64 amount = 1 ) {
+		counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+};
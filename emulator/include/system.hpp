@@ -0,0 +1,60 @@
+#pragma once
+
+#include "types.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+
+#include <memory>
+#include <vector>
+
+/**
+ * Several CPUs on one board: each has its own Mem, and a window of RAM is
+ * mapped (as SHARED pages) into all of them.
+ *
+ * Every CPU keeps its own cycle clock. The CPU furthest behind (lowest clock,
+ * then lowest index) always goes next, so accesses to the shared window happen
+ * in a fixed order and a run is deterministic.
+ *
+ * INSTRUCTION interleaving switches CPU after every instruction. SHARED_ACCESS
+ * interleaving lets a CPU run on as long as its instructions stay out of the
+ * shared window (decoded before they run), and only stops it in front of a
+ * shared access it is not yet allowed to make. Both give the same result, the
+ * second with far fewer switches.
+ * */
+struct System {
+	enum Interleave {
+		INSTRUCTION,
+		SHARED_ACCESS,
+	};
+
+	struct Node {
+		CPU cpu;
+		u64 time = 0;	// cycles executed
+		Mem memory;
+	};
+
+	Interleave mode;
+	u16 shared_base;
+	u32 shared_size;
+	u64 switches = 0;	// times a CPU was picked to run
+
+	/** the shared window must be whole pages, throws otherwise */
+	System( u32 cpus, u16 shared_base, u32 shared_size, Interleave mode = SHARED_ACCESS );
+
+	Node& node( u32 index );
+	u32 size() const;
+	byte* shared();
+
+	/** runs until every CPU has executed (at least) `cycles` more than the one furthest behind */
+	void run( u64 cycles );
+
+	/** whether the next instruction of the node reads or writes the shared window */
+	bool touches_shared( const Node& node ) const;
+
+private:
+	std::vector<std::unique_ptr<Node>> nodes;
+	std::vector<byte> shared_ram;
+
+	bool goes_first( u32 index ) const;
+	bool is_shared( u16 address ) const;
+};
@@ -3,6 +3,8 @@
 typedef unsigned short	u16;
 typedef int 			i32;
 typedef unsigned int	u32;
+typedef long long i64;
+typedef unsigned long long u64;
 
 typedef unsigned char	byte;
 typedef unsigned short	word;
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "types.hpp"
+#include "device.hpp"
+
+/**
+ * 6522 VIA: two 8-bit ports and two 16-bit timers.
+ *
+ * The timers are never ticked. A counter is kept as the value it was loaded
+ * with and the cycle it was loaded at, and its current value is computed from
+ * the cycle delta when it is read. Each underflow that can interrupt is one
+ * scheduled Mem event: timer 1 in free-running mode schedules the next one
+ * from its handler, so a periodic interrupt costs one event per period.
+ *
+ * Not emulated: the shift register (SR is a plain latch), handshaking on
+ * CA/CB, PB7 output and timer 2 pulse counting (its counter holds still).
+ * */
+struct Via : Device {
+	static constexpr u16 SIZE = 0x10;
+
+	enum Register : byte {
+		ORB, ORA, DDRB, DDRA,
+		T1C_L, T1C_H, T1L_L, T1L_H,
+		T2C_L, T2C_H,
+		SR, ACR, PCR, IFR, IER,
+		ORA_NH,	// ORA without handshake
+	};
+
+	/** IFR/IER bits */
+	static constexpr byte IRQ_T2	= 0b00100000;
+	static constexpr byte IRQ_T1	= 0b01000000;
+	static constexpr byte IRQ_ANY	= 0b10000000;
+
+	/** ACR bits */
+	static constexpr byte ACR_T1_CONTINUOUS	= 0b01000000;
+	static constexpr byte ACR_T2_PULSES		= 0b00100000;
+
+	byte port_a_in = 0xFF;	// levels on the input pins of the ports, set by the host
+	byte port_b_in = 0xFF;
+
+	u64 t1_underflows = 0;	// interrupts requested by each timer
+	u64 t2_underflows = 0;
+
+	/** `line` is the Mem interrupt line the VIA drives */
+	explicit Via( u32 line = 0 );
+
+	/** the counters at the given bus time */
+	u16 timer1( u64 cycle ) const;
+	u16 timer2( u64 cycle ) const;
+
+	byte read( u16 offset, u64 cycle ) override;
+	void write( u16 offset, byte value, u64 cycle ) override;
+	byte peek( u16 offset ) const override;
+	void on_event( u64 cycle, u32 tag ) override;
+
+private:
+	enum Event : u32 { T1_UNDERFLOW = 1, T2_UNDERFLOW = 2 };
+
+	u32 line;
+	byte ora = 0x00, orb = 0x00, ddra = 0x00, ddrb = 0x00;
+	byte sr = 0x00, acr = 0x00, pcr = 0x00, ifr = 0x00, ier = 0x00;
+
+	u16 t1_latch = 0xFFFF;
+	u16 t1_value = 0xFFFF;	// counter value at t1_start (the last load or reload)
+	u64 t1_start = 0;
+	bool t1_armed = false;	// the next underflow interrupts
+
+	byte t2_latch_low = 0xFF;
+	u16 t2_value = 0xFFFF;
+	u64 t2_start = 0;
+	bool t2_armed = false;
+
+	byte read_register( u16 offset, u64 cycle ) const;
+	void load_timer1( u16 value, u64 cycle );
+	void load_timer2( u16 value, u64 cycle );
+	void set_flags( byte flags );
+	void clear_flags( byte flags );
+};
@@ -0,0 +1,95 @@
+#include "async.hpp"
+#include <chrono>
+#include <pthread.h>
+#include <sched.h>
+
+static void backoff( u32& spins ) {
+	if (spins++ < 64) std::this_thread::yield();
+	else std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+AsyncMachine::~AsyncMachine() { stop(); }
+
+void AsyncMachine::start( i32 core ) {
+	if (running.exchange(true)) return;
+	thread = std::thread(&AsyncMachine::work, this, core);
+}
+
+void AsyncMachine::stop() {
+	running.store(false, std::memory_order_release);
+	if (thread.joinable()) thread.join();
+}
+
+bool AsyncMachine::send( const Command& command ) { return commands.push(command); }
+bool AsyncMachine::poll( Event& event ) { return events.pop(event); }
+u64 AsyncMachine::dropped_events() const { return dropped.load(std::memory_order_relaxed); }
+
+void AsyncMachine::work( i32 core ) {
+	// pinned before the first instruction, so it never runs (or touches memory) elsewhere
+	if (core >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+	u32 spins = 0;
+	while (running.load(std::memory_order_acquire)) {
+		Command command;
+		if (!commands.pop(command)) {
+			backoff(spins);
+			continue;
+		}
+		spins = 0;
+		handle(command);
+	}
+}
+
+void AsyncMachine::handle( const Command& command ) {
+	Event event = {};
+	event.type = command.type;
+	event.tag = command.tag;
+
+	switch (command.type) {
+		case Command::RUN:
+		{
+			while (event.cycles < command.cycles && running.load(std::memory_order_relaxed)) {
+				u32 left = command.cycles - event.cycles;
+				event.cycles += cpu.execute(memory, left < (u32)SLICE ? left : SLICE);
+			}
+			total_cycles += event.cycles;
+		} break;
+
+		case Command::POKE:
+		{
+			memory[command.address] = command.value;
+		} break;
+
+		case Command::PEEK:
+		{
+			// an inspection, a device register must not see a guest read
+			event.value = memory.peek(command.address);
+		} break;
+
+		case Command::SNAPSHOT:
+		{
+			if (command.target) *command.target = memory;
+		} break;
+	}
+
+	event.total_cycles = total_cycles;
+	event.cpu = cpu;
+	emit(event);
+}
+
+void AsyncMachine::emit( const Event& event ) {
+	// a host that does not drain its events slows the machine down, only a stop drops them
+	u32 spins = 0;
+	while (!events.push(event)) {
+		if (!running.load(std::memory_order_acquire)) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		backoff(spins);
+	}
+}
@@ -0,0 +1,150 @@
+#include "block.hpp"
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+BlockDevice::BlockDevice( const std::string& path, bool writable, u32 line, u64 seek_cycles, u64 sector_cycles )
+	: writable(writable), line(line), seek_cycles(seek_cycles), sector_cycles(sector_cycles) {
+	fd = open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+	if (fd < 0) throw std::runtime_error("BlockDevice: cannot open " + path);
+
+	struct stat info;
+	if (fstat(fd, &info) < 0 || info.st_size < (off_t)SECTOR_SIZE) {
+		close(fd);
+		throw std::runtime_error("BlockDevice: " + path + " is not a disk image");
+	}
+	image_size = info.st_size;
+	image = (byte*)mmap(nullptr, image_size, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+	if (image == MAP_FAILED) {
+		close(fd);
+		throw std::runtime_error("BlockDevice: cannot map " + path);
+	}
+	madvise(image, image_size, MADV_SEQUENTIAL);
+
+	helper = std::thread(&BlockDevice::work, this);
+}
+
+BlockDevice::~BlockDevice() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wakeup.notify_one();
+	helper.join();
+	munmap(image, image_size);
+	close(fd);
+}
+
+u32 BlockDevice::sectors() const { return image_size / SECTOR_SIZE; }
+
+byte BlockDevice::read( u16 offset, u64 cycle ) {
+	(void)cycle;
+	byte value = peek(offset);
+	if (offset == STATUS && (status & DONE)) {
+		status &= ~DONE;
+		bus->clear_irq(line);
+	}
+	return value;
+}
+
+byte BlockDevice::peek( u16 offset ) const {
+	if (offset == STATUS) return status;
+	return offset < SIZE ? registers[offset] : 0x00;
+}
+
+void BlockDevice::write( u16 offset, byte value, u64 cycle ) {
+	if (offset >= SIZE || offset == STATUS) return;
+	// the transfer in flight owns them
+	if ((status & BUSY) && offset != CONTROL) return;
+	registers[offset] = value;
+	if (offset == COMMAND) start(value, cycle);
+}
+
+void BlockDevice::start( byte command, u64 cycle ) {
+	u32 sector = registers[SECTOR_L] | (registers[SECTOR_H] << 8);
+	u32 count = registers[COUNT];
+
+	if ((command != READ && command != WRITE) || (command == WRITE && !writable) || sector + count > sectors()) {
+		status = ERROR | DONE;
+		if (registers[CONTROL] & IRQ_ENABLE) bus->raise_irq(line);
+		return;
+	}
+	status = BUSY;
+	transfer = Transfer{ command, sector, count, (u16)(registers[ADDRESS_L] | (registers[ADDRESS_H] << 8)) };
+
+	// fault the sectors in while the latency runs, and read ahead of a sequential stream
+	bool sequential = sector == next_sequential;
+	u32 end = sector + count;
+	if (sequential) {
+		if (window < MAX_READAHEAD) window *= 2;
+		end += window;
+	} else {
+		window = 8;
+	}
+	if (end > sectors()) end = sectors();
+	prefetch(sector, end);
+	next_sequential = sector + count;
+
+	// no seek when the head is already there
+	u64 latency = (sequential ? 0 : seek_cycles) + count * sector_cycles;
+	bus->schedule(*this, cycle + latency);
+}
+
+void BlockDevice::on_event( u64 cycle, u32 tag ) {
+	(void)cycle;
+	(void)tag;
+	if (status & BUSY) complete();
+}
+
+void BlockDevice::complete() {
+	// only what start() checked, never the registers again
+	u32 size = transfer.count * SECTOR_SIZE;
+	byte* data = image + (u64)transfer.sector * SECTOR_SIZE;
+
+	if (transfer.command == READ) bus->write_block(transfer.address, data, size);
+	else bus->read_block(transfer.address, data, size);
+
+	transfers++;
+	status = DONE;
+	if (registers[CONTROL] & IRQ_ENABLE) bus->raise_irq(line);
+}
+
+void BlockDevice::prefetch( u32 begin, u32 end ) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		// merged with a request the helper has not picked up yet
+		if (prefetch_begin < prefetch_end) {
+			if (begin > prefetch_begin) begin = prefetch_begin;
+			if (end < prefetch_end) end = prefetch_end;
+		}
+		prefetch_begin = begin;
+		prefetch_end = end;
+	}
+	wakeup.notify_one();
+}
+
+void BlockDevice::work() {
+	const u64 page = sysconf(_SC_PAGESIZE);
+	std::unique_lock<std::mutex> guard(lock);
+	while (true) {
+		wakeup.wait(guard, [this] { return stopping || prefetch_begin < prefetch_end; });
+		if (stopping) return;
+
+		u64 begin = (u64)prefetch_begin * SECTOR_SIZE;
+		u64 end = (u64)prefetch_end * SECTOR_SIZE;
+		u32 sectors = prefetch_end - prefetch_begin;
+		prefetch_begin = prefetch_end = 0;
+		guard.unlock();
+
+		// start the I/O for the whole range, then touch every page so it is mapped
+		u64 first = begin & ~(page - 1);
+		madvise(image + first, end - first, MADV_WILLNEED);
+		volatile byte sink = 0;
+		for (u64 offset=first; offset<end; offset+=page) sink = sink + image[offset];
+		prefetched.fetch_add(sectors, std::memory_order_relaxed);
+
+		guard.lock();
+	}
+}
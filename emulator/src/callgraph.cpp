@@ -0,0 +1,132 @@
+#include "callgraph.hpp"
+#include "cpu_impl.hpp"
+#include <algorithm>
+#include <cstdio>
+
+/** a name as the body of a quoted JSON or DOT string */
+static std::string escape( const std::string& text ) {
+	std::string out;
+	for (char c : text) {
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		} else if ((unsigned char)c < 0x20) {
+			char code[8];
+			std::snprintf(code, sizeof(code), "\\u%04x", c);
+			out += code;
+		} else {
+			out += c;
+		}
+	}
+	return out;
+}
+
+void CallGraph::retire( const CPU& cpu, const Mem& memory, u16 pc, byte opcode, u32 cycles ) {
+	(void)memory;
+	(void)pc;
+	functions[current()].exclusive += cycles;
+	time += cycles;
+
+	switch (opcode) {
+		case CPU::INS_JSR_AB:
+		{
+			u32 callee = cpu.PC;
+			Frame frame{ callee, current(), (byte)(cpu.SP + 2), time };
+			Function& function = functions[callee];
+			function.calls++;
+			function.active++;
+			edges[{ frame.caller, callee }].calls++;
+			stack.push_back(frame);
+		} break;
+
+		case CPU::INS_RTS:
+		case CPU::INS_RTI:
+		case CPU::INS_TXS:
+			unwind(cpu.SP);
+			break;
+	}
+}
+
+void CallGraph::close() {
+	while (!stack.empty()) pop();
+}
+
+u32 CallGraph::depth() const { return stack.size(); }
+
+const CallGraph::Function& CallGraph::function( u32 address ) const {
+	static const Function none;
+	auto found = functions.find(address);
+	return found != functions.end() ? found->second : none;
+}
+
+const CallGraph::Edge& CallGraph::edge( u32 caller, u32 callee ) const {
+	static const Edge none;
+	auto found = edges.find({ caller, callee });
+	return found != edges.end() ? found->second : none;
+}
+
+u32 CallGraph::current() const { return stack.empty() ? ROOT : stack.back().function; }
+
+void CallGraph::unwind( byte sp ) {
+	// the return address of a frame sits right below its return_sp; the stack
+	// pointer wraps, so "at or above" is a distance within the page
+	while (!stack.empty() && (signed char)(sp - stack.back().return_sp) >= 0) pop();
+}
+
+void CallGraph::pop() {
+	Frame frame = stack.back();
+	stack.pop_back();
+	u64 duration = time - frame.entry;
+
+	Function& function = functions[frame.function];
+	function.active--;
+	if (function.active == 0) function.inclusive += duration;
+	edges[{ frame.caller, frame.function }].cycles += duration;
+
+	if (trace.size() < max_trace_events) trace.push_back(Call{ frame.function, frame.entry, duration, (u32)stack.size() });
+	else dropped_trace_events++;
+}
+
+std::string CallGraph::name( u32 function ) const {
+	return function == ROOT ? "[root]" : symbols.describe(function);
+}
+
+void CallGraph::write_report( std::ostream& out ) const {
+	std::vector<u32> order;
+	u64 root_time = time;
+	for (auto& [address, function] : functions) order.push_back(address);
+	auto inclusive = [&]( u32 address ) { return address == ROOT ? root_time : function(address).inclusive; };
+	std::sort(order.begin(), order.end(), [&]( u32 a, u32 b ) { return inclusive(a) > inclusive(b); });
+
+	out << std::dec << "inclusive\texclusive\tcalls\tfunction\n";
+	for (u32 address : order) {
+		const Function& entry = function(address);
+		out << inclusive(address) << "\t" << entry.exclusive << "\t" << entry.calls << "\t" << name(address) << "\n";
+	}
+	out << "\ncalls\tcycles\tcaller -> callee\n";
+	for (auto& [key, entry] : edges)
+		out << entry.calls << "\t" << entry.cycles << "\t" << name(key.first) << " -> " << name(key.second) << "\n";
+}
+
+void CallGraph::write_dot( std::ostream& out ) const {
+	out << std::dec << "digraph calls {\n\tnode [shape=box];\n";
+	for (auto& [address, entry] : functions)
+		out << "\t\"" << escape(name(address)) << "\" [label=\"" << escape(name(address)) << "\\n"
+			<< entry.exclusive << " / " << (address == ROOT ? time : entry.inclusive) << " cycles\"];\n";
+	for (auto& [key, entry] : edges)
+		out << "\t\"" << escape(name(key.first)) << "\" -> \"" << escape(name(key.second)) << "\" [label=\""
+			<< entry.calls << " calls\\n" << entry.cycles << " cycles\"];\n";
+	out << "}\n";
+}
+
+void CallGraph::write_trace( std::ostream& out ) const {
+	out << std::dec << "{\"traceEvents\":[";
+	for (u32 i=0; i<trace.size(); i++) {
+		const Call& call = trace[i];
+		out << (i ? ",\n" : "\n") << "{\"name\":\"" << escape(name(call.function)) << "\",\"ph\":\"X\",\"ts\":" << call.start
+			<< ",\"dur\":" << call.duration << ",\"pid\":0,\"tid\":0,\"args\":{\"depth\":" << call.depth << "}}";
+	}
+	out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+}
+
+template u32 CPU::execute<CallGraph>( Mem& memory, i32 cycles, CallGraph& probe );
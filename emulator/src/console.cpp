@@ -0,0 +1,84 @@
+#include "console.hpp"
+#include <cerrno>
+#include <stdexcept>
+#include <sys/uio.h>
+
+Console::Console( int fd, u32 capacity, u64 idle_cycles, bool line_buffered )
+	: fd(fd), idle_cycles(idle_cycles), line_buffered(line_buffered), ring(capacity) {
+	// write() wraps around the ring, there has to be at least one byte
+	if (capacity == 0) throw std::invalid_argument("Console: the output buffer cannot be empty");
+}
+
+Console::~Console() { flush(); }
+
+void Console::feed( const std::string& text ) {
+	// drop what was consumed before it grows
+	input.erase(0, input_next);
+	input_next = 0;
+	input += text;
+}
+
+void Console::flush() {
+	while (count > 0) {
+		// at most two pieces, the ring may wrap
+		u32 first = head + count <= ring.size() ? count : ring.size() - head;
+		iovec pieces[2] = {
+			{ &ring[head], first },
+			{ &ring[0], count - first },
+		};
+		ssize_t written = writev(fd, pieces, count > first ? 2 : 1);
+		if (written < 0 && errno == EINTR) continue;
+		flushes++;
+		if (written <= 0) {
+			// nowhere to write to, the output is lost
+			head = count = 0;
+			return;
+		}
+		head = (head + written) % ring.size();
+		count -= written;
+	}
+}
+
+u32 Console::buffered() const { return count; }
+
+byte Console::read( u16 offset, u64 cycle ) {
+	(void)cycle;
+	if (offset == DATA && input_next < input.size()) return input[input_next++];
+	return peek(offset);
+}
+
+byte Console::peek( u16 offset ) const {
+	if (offset == STATUS) return OUTPUT_READY | (input_next < input.size() ? INPUT_READY : 0x00);
+	if (offset == DATA && input_next < input.size()) return input[input_next];
+	return 0x00;
+}
+
+void Console::write( u16 offset, byte value, u64 cycle ) {
+	if (offset != DATA) return;
+
+	if (count == ring.size()) flush();
+	ring[(head + count) % ring.size()] = value;
+	count++;
+	bytes_out++;
+	last_write = cycle;
+
+	if (count == ring.size() || (line_buffered && value == '\n')) {
+		flush();
+	} else if (!idle_pending) {
+		idle_pending = true;
+		bus->schedule(*this, cycle + idle_cycles);
+	}
+}
+
+void Console::on_event( u64 cycle, u32 tag ) {
+	(void)tag;
+	idle_pending = false;
+	if (count == 0) return;
+	// only one idle event at a time, it is pushed back while the guest keeps writing
+	if (cycle - last_write < idle_cycles) {
+		idle_pending = true;
+		bus->schedule(*this, last_write + idle_cycles);
+		return;
+	}
+	flush();
+}
@@ -0,0 +1,157 @@
+#include "coroutine.hpp"
+#include <cstdlib>
+#include <exception>
+#include <stdexcept>
+
+/** FrameArena */
+
+FrameArena::FrameArena() : cursor(nullptr), end(nullptr), frames(0) {
+	for (u32 i=0; i<SIZE_CLASSES; i++) free_lists[i] = nullptr;
+}
+
+FrameArena::~FrameArena() {
+	for (byte* chunk : chunks) delete[] chunk;
+}
+
+void* FrameArena::allocate( std::size_t size ) {
+	// the header in front of the frame points back to the arena
+	static_assert(sizeof(Header) <= ALIGN);
+	std::size_t total = (size + ALIGN + ALIGN - 1) / ALIGN * ALIGN;
+	u32 size_class = total / ALIGN;
+	byte* block;
+
+	if (size_class >= SIZE_CLASSES) {
+		block = (byte*)::operator new(total);
+	} else if (free_lists[size_class]) {
+		block = (byte*)free_lists[size_class];
+		free_lists[size_class] = free_lists[size_class]->next;
+	} else {
+		if (!cursor || cursor + total > end) {
+			chunks.push_back(new byte[CHUNK_SIZE]); // operator new aligns to 16
+			cursor = chunks.back();
+			end = cursor + CHUNK_SIZE;
+		}
+		block = cursor;
+		cursor += total;
+	}
+
+	*(Header*)block = Header{ this, total };
+	frames++;
+	return block + ALIGN;
+}
+
+void FrameArena::deallocate( void* frame ) {
+	byte* block = (byte*)frame - ALIGN;
+	FrameArena* arena = ((Header*)block)->arena;
+	u32 size_class = ((Header*)block)->size / ALIGN;
+
+	arena->frames--;
+	if (size_class >= SIZE_CLASSES) {
+		::operator delete(block);
+		return;
+	}
+	FreeFrame* free = (FreeFrame*)block;
+	free->next = arena->free_lists[size_class];
+	arena->free_lists[size_class] = free;
+}
+
+u32 FrameArena::live() const { return frames; }
+u64 FrameArena::reserved() const { return (u64)chunks.size() * CHUNK_SIZE; }
+
+/** DeviceTask */
+
+void DeviceTask::promise_type::unhandled_exception() {
+	// a device has nobody to report to, the bus it sits on would be left inconsistent
+	std::terminate();
+}
+
+DeviceTask& DeviceTask::operator=( DeviceTask&& other ) {
+	if (this != &other) {
+		if (handle) handle.destroy();
+		handle = other.handle;
+		other.handle = nullptr;
+	}
+	return *this;
+}
+
+DeviceTask::~DeviceTask() { if (handle) handle.destroy(); }
+
+/** CoDevice */
+
+CoDevice::CoDevice( FrameArena& arena ) : arena(&arena) {}
+
+void CoDevice::start( DeviceTask body ) {
+	// the body's waits are events on the bus
+	if (!bus) throw std::logic_error("CoDevice: start the body once the device is attached");
+	if (wait != NONE) bus->cancel(*this, generation);
+	wait = NONE;
+	waiting = nullptr;
+	pending.clear();
+	task = std::move(body);
+	time = bus->now;
+	task.handle.resume();
+}
+
+void CoDevice::respond( byte value ) {
+	reply = value;
+	replied = true;
+}
+
+byte CoDevice::read( u16 offset, u64 cycle ) {
+	if (wait != ACCESS) return peek(offset);
+	current = Access{ Access::READ, offset, 0x00, cycle };
+	replied = false;
+	resume(cycle);
+	return replied ? reply : peek(offset);
+}
+
+void CoDevice::write( u16 offset, byte value, u64 cycle ) {
+	Access access{ Access::WRITE, offset, value, cycle };
+	if (wait != ACCESS) {
+		pending.push_back(access);
+		return;
+	}
+	current = access;
+	resume(cycle);
+}
+
+void CoDevice::on_event( u64 cycle, u32 tag ) {
+	if (wait == NONE || tag != generation) return;
+	if (wait == ACCESS) current = Access{ Access::TIMEOUT, 0, 0x00, cycle };
+	resume(cycle);
+}
+
+void CoDevice::Cycles::await_suspend( std::coroutine_handle<> handle ) {
+	device.suspend(handle, CYCLES, device.time + count);
+}
+
+void CoDevice::NextAccess::await_suspend( std::coroutine_handle<> handle ) {
+	u64 until = timeout == Mem::NEVER ? Mem::NEVER : device.time + timeout;
+	device.suspend(handle, ACCESS, until);
+}
+
+CoDevice::Access CoDevice::NextAccess::await_resume() {
+	if (device.pending.empty()) return device.current;
+	// queued while the body was busy, in arrival order
+	Access access = device.pending.front();
+	device.pending.erase(device.pending.begin());
+	if (access.cycle > device.time) device.time = access.cycle;
+	return access;
+}
+
+void CoDevice::suspend( std::coroutine_handle<> handle, Wait kind, u64 until ) {
+	waiting = handle;
+	wait = kind;
+	generation++;
+	if (until != Mem::NEVER) bus->schedule(*this, until, generation);
+}
+
+void CoDevice::resume( u64 cycle ) {
+	// a timeout that did not fire is dropped with the wait it belonged to
+	if (wait == ACCESS) bus->cancel(*this, generation);
+	time = cycle;
+	wait = NONE;
+	std::coroutine_handle<> handle = waiting;
+	waiting = nullptr;
+	handle.resume();
+}
@@ -0,0 +1,75 @@
+#include "counter.hpp"
+#include <iomanip>
+
+void CycleCounter::Slot::add( u64 cycles ) {
+	count++;
+	total += cycles;
+	if (cycles < min) min = cycles;
+	if (cycles > max) max = cycles;
+	u32 bucket = cycles ? 64 - __builtin_clzll(cycles) : 0;
+	buckets[bucket < BUCKETS ? bucket : BUCKETS - 1]++;
+}
+
+u64 CycleCounter::Slot::mean() const { return count ? total / count : 0; }
+
+u64 CycleCounter::Slot::percentile( double fraction ) const {
+	u64 wanted = (u64)(fraction * count + 0.5);
+	u64 seen = 0;
+	for (u32 bucket=0; bucket<BUCKETS; bucket++) {
+		seen += buckets[bucket];
+		if (seen >= wanted && seen > 0) {
+			// the upper bound of the bucket, clamped to what was measured
+			u64 bound = bucket ? (1ull << bucket) - 1 : 0;
+			return bound < max ? bound : max;
+		}
+	}
+	return max;
+}
+
+const CycleCounter::Slot& CycleCounter::slot( u32 index ) const { return slots[index % SLOTS]; }
+
+void CycleCounter::reset() {
+	for (Slot& slot : slots) slot = Slot();
+	unmatched_stops = 0;
+}
+
+void CycleCounter::report( std::ostream& out ) const {
+	for (u32 i=0; i<SLOTS; i++) {
+		const Slot& slot = slots[i];
+		if (!slot.count) continue;
+		out << std::dec << "slot " << std::setw(2) << i
+			<< "  count " << slot.count
+			<< "  min " << slot.min
+			<< "  mean " << slot.mean()
+			<< "  p50 " << slot.percentile(0.5)
+			<< "  p99 " << slot.percentile(0.99)
+			<< "  max " << slot.max << std::endl;
+	}
+}
+
+byte CycleCounter::read( u16 offset, u64 cycle ) {
+	if (offset == COUNTER_0) latched = cycle;
+	return peek(offset);
+}
+
+byte CycleCounter::peek( u16 offset ) const {
+	if (offset <= COUNTER_7) return (latched >> (offset * 8)) & 0xFF;
+	return 0x00;
+}
+
+void CycleCounter::write( u16 offset, byte value, u64 cycle ) {
+	Slot& slot = slots[value % SLOTS];
+	switch (offset) {
+		case LATCH:	latched = cycle; break;
+		case START:	slot.started = cycle; break;
+		case STOP:
+		{
+			if (slot.started == ~0ull || cycle < slot.started) {
+				unmatched_stops++;
+				break;
+			}
+			slot.add(cycle - slot.started);
+			slot.started = ~0ull;
+		} break;
+	}
+}
@@ -0,0 +1,102 @@
+#include "decode.hpp"
+#include "cpu.hpp"
+
+struct OpTable {
+	OpInfo ops[256];
+
+	void set( byte opcode, const char* name, AddressingMode mode, byte cycles ) {
+		static constexpr byte lengths[] = { 1, 2, 2, 2, 2, 3, 3, 3, 3, 2, 2 };
+		ops[opcode] = OpInfo{ name, mode, lengths[mode], cycles };
+	}
+
+	// cycles are the ones CPU::execute charges
+	OpTable() {
+		for (u32 i=0; i<256; i++) ops[i] = OpInfo{ nullptr, IMPLIED, 1, 1 };
+
+		set(CPU::INS_LDA_IM, "LDA", IMMEDIATE, 2);
+		set(CPU::INS_LDA_ZP, "LDA", ZERO_PAGE, 3);
+		set(CPU::INS_LDA_ZPX, "LDA", ZERO_PAGE_X, 4);
+		set(CPU::INS_LDA_AB, "LDA", ABSOLUTE, 4);
+		set(CPU::INS_LDA_ABX, "LDA", ABSOLUTE_X, 4);
+		set(CPU::INS_LDA_ABY, "LDA", ABSOLUTE_Y, 4);
+		set(CPU::INS_LDA_INX, "LDA", INDEXED_INDIRECT, 6);
+		set(CPU::INS_LDA_INY, "LDA", INDIRECT_INDEXED, 5);
+
+		set(CPU::INS_LDX_IM, "LDX", IMMEDIATE, 2);
+		set(CPU::INS_LDX_ZP, "LDX", ZERO_PAGE, 3);
+		set(CPU::INS_LDX_ZPY, "LDX", ZERO_PAGE_Y, 4);
+		set(CPU::INS_LDX_AB, "LDX", ABSOLUTE, 4);
+		set(CPU::INS_LDX_ABY, "LDX", ABSOLUTE_Y, 4);
+
+		set(CPU::INS_LDY_IM, "LDY", IMMEDIATE, 2);
+		set(CPU::INS_LDY_ZP, "LDY", ZERO_PAGE, 3);
+		set(CPU::INS_LDY_ZPX, "LDY", ZERO_PAGE_X, 4);
+		set(CPU::INS_LDY_AB, "LDY", ABSOLUTE, 4);
+		set(CPU::INS_LDY_ABX, "LDY", ABSOLUTE_X, 4);
+
+		set(CPU::INS_STA_ZP, "STA", ZERO_PAGE, 3);
+		set(CPU::INS_STA_ZPX, "STA", ZERO_PAGE_X, 4);
+		set(CPU::INS_STA_AB, "STA", ABSOLUTE, 4);
+		set(CPU::INS_STA_ABX, "STA", ABSOLUTE_X, 5);
+		set(CPU::INS_STA_ABY, "STA", ABSOLUTE_Y, 5);
+		set(CPU::INS_STA_INX, "STA", INDEXED_INDIRECT, 6);
+		set(CPU::INS_STA_INY, "STA", INDIRECT_INDEXED, 5);
+
+		set(CPU::INS_STX_ZP, "STX", ZERO_PAGE, 3);
+		set(CPU::INS_STX_ZPY, "STX", ZERO_PAGE_Y, 4);
+		set(CPU::INS_STX_AB, "STX", ABSOLUTE, 4);
+
+		set(CPU::INS_STY_ZP, "STY", ZERO_PAGE, 3);
+		set(CPU::INS_STY_ZPX, "STY", ZERO_PAGE_X, 4);
+		set(CPU::INS_STY_AB, "STY", ABSOLUTE, 4);
+
+		set(CPU::INS_TAX, "TAX", IMPLIED, 1);
+		set(CPU::INS_TAY, "TAY", IMPLIED, 1);
+		set(CPU::INS_TXA, "TXA", IMPLIED, 1);
+		set(CPU::INS_TYA, "TYA", IMPLIED, 1);
+
+		set(CPU::INS_TSX, "TSX", IMPLIED, 1);
+		set(CPU::INS_TXS, "TXS", IMPLIED, 1);
+		set(CPU::INS_PHA, "PHA", IMPLIED, 3);
+		set(CPU::INS_PHP, "PHP", IMPLIED, 3);
+		set(CPU::INS_PLA, "PLA", IMPLIED, 4);
+		set(CPU::INS_PLP, "PLP", IMPLIED, 4);
+
+		const char* logic[] = { "AND", "EOR", "ORA" };
+		const byte logic_ops[3][8] = {
+			{ CPU::INS_AND_IM, CPU::INS_AND_ZP, CPU::INS_AND_ZPX, CPU::INS_AND_AB,
+				CPU::INS_AND_ABX, CPU::INS_AND_ABY, CPU::INS_AND_INX, CPU::INS_AND_INY },
+			{ CPU::INS_EOR_IM, CPU::INS_EOR_ZP, CPU::INS_EOR_ZPX, CPU::INS_EOR_AB,
+				CPU::INS_EOR_ABX, CPU::INS_EOR_ABY, CPU::INS_EOR_INX, CPU::INS_EOR_INY },
+			{ CPU::INS_ORA_IM, CPU::INS_ORA_ZP, CPU::INS_ORA_ZPX, CPU::INS_ORA_AB,
+				CPU::INS_ORA_ABX, CPU::INS_ORA_ABY, CPU::INS_ORA_INX, CPU::INS_ORA_INY },
+		};
+		for (u32 i=0; i<3; i++) {
+			set(logic_ops[i][0], logic[i], IMMEDIATE, 2);
+			set(logic_ops[i][1], logic[i], ZERO_PAGE, 3);
+			set(logic_ops[i][2], logic[i], ZERO_PAGE_X, 4);
+			set(logic_ops[i][3], logic[i], ABSOLUTE, 4);
+			set(logic_ops[i][4], logic[i], ABSOLUTE_X, 4);
+			set(logic_ops[i][5], logic[i], ABSOLUTE_Y, 4);
+			set(logic_ops[i][6], logic[i], INDEXED_INDIRECT, 6);
+			set(logic_ops[i][7], logic[i], INDIRECT_INDEXED, 5);
+		}
+
+		set(CPU::INS_BIT_ZP, "BIT", ZERO_PAGE, 3);
+		set(CPU::INS_BIT_AB, "BIT", ABSOLUTE, 4);
+
+		set(CPU::INS_JMP_AB, "JMP", ABSOLUTE, 3);
+		set(CPU::INS_JMP_IN, "JMP", INDIRECT, 5);
+		set(CPU::INS_JSR_AB, "JSR", ABSOLUTE, 6);
+		set(CPU::INS_RTS, "RTS", IMPLIED, 6);
+
+		set(CPU::INS_RTI, "RTI", IMPLIED, 6);
+		set(CPU::INS_CLI, "CLI", IMPLIED, 2);
+		set(CPU::INS_SEI, "SEI", IMPLIED, 2);
+	}
+};
+
+const OpInfo& op_info( byte opcode ) {
+	static const OpTable table;
+	return table.ops[opcode];
+}
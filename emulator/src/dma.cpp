@@ -0,0 +1,55 @@
+#include "dma.hpp"
+
+Dma::Dma( u32 line, u32 cycles_per_byte ) : line(line), cycles_per_byte(cycles_per_byte) {}
+
+byte Dma::read( u16 offset, u64 cycle ) {
+	(void)cycle;
+	byte value = peek(offset);
+	if (offset == STATUS && (status & DONE)) {
+		status &= ~DONE;
+		bus->clear_irq(line);
+	}
+	return value;
+}
+
+byte Dma::peek( u16 offset ) const {
+	if (offset == STATUS) return status;
+	return offset < SIZE ? registers[offset] : 0x00;
+}
+
+void Dma::write( u16 offset, byte value, u64 cycle ) {
+	if (offset >= SIZE || offset == STATUS) return;
+	registers[offset] = value & ~(offset == CONTROL ? START : 0x00);
+	if (offset == CONTROL && (value & START) && !(status & BUSY)) start(cycle);
+}
+
+void Dma::start( u64 cycle ) {
+	u16 source = registers[SOURCE_L] | (registers[SOURCE_H] << 8);
+	u16 destination = registers[DESTINATION_L] | (registers[DESTINATION_H] << 8);
+	u32 length = registers[LENGTH_L] | (registers[LENGTH_H] << 8);
+	byte control = registers[CONTROL];
+
+	if (!(control & (SOURCE_FIXED | DESTINATION_FIXED))) {
+		bus->move_block(destination, source, length);
+	} else {
+		for (u32 i=0; i<length; i++) {
+			u16 from = source + ((control & SOURCE_FIXED) ? 0 : i);
+			u16 to = destination + ((control & DESTINATION_FIXED) ? 0 : i);
+			bus->write(to, bus->read(from));
+		}
+	}
+
+	transfers++;
+	bytes += length;
+	status = BUSY;
+	u64 stolen = (u64)length * cycles_per_byte;
+	bus->steal(stolen);
+	bus->schedule(*this, cycle + stolen);
+}
+
+void Dma::on_event( u64 cycle, u32 tag ) {
+	(void)cycle;
+	(void)tag;
+	status = DONE;
+	if (registers[CONTROL] & IRQ_ENABLE) bus->raise_irq(line);
+}
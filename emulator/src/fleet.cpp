@@ -0,0 +1,108 @@
+#include "fleet.hpp"
+#include <stdexcept>
+#include <thread>
+
+Fleet::Fleet( u32 workers, i32 quantum ) : worker_count(workers), quantum(quantum), remaining(0) {
+	// a slice of no cycles would never get an instance anywhere
+	if (quantum <= 0) throw std::invalid_argument("Fleet: the quantum must be at least one cycle");
+	if (worker_count == 0) worker_count = std::thread::hardware_concurrency();
+	if (worker_count == 0) worker_count = 1;
+	for (u32 i=0; i<worker_count; i++) this->workers.push_back(std::make_unique<Worker>());
+}
+
+u32 Fleet::add( StopCondition stop, u64 cycle_limit ) {
+	auto instance = std::make_unique<Instance>();
+	instance->stop = stop;
+	instance->cycle_limit = cycle_limit;
+	instances.push_back(std::move(instance));
+	return instances.size() - 1;
+}
+
+Fleet::Instance& Fleet::instance( u32 id ) { return *instances[id]; }
+u32 Fleet::size() const { return instances.size(); }
+
+Fleet::Stats Fleet::run() {
+	// deal the unfinished instances round robin, stealing evens out the rest
+	u32 queued = 0;
+	for (u32 id=0; id<instances.size(); id++) {
+		if (instances[id]->done) continue;
+		workers[queued % worker_count]->jobs.push_back(id);
+		queued++;
+	}
+	remaining = queued;
+
+	std::vector<std::thread> threads;
+	for (u32 i=1; i<worker_count; i++) threads.emplace_back(&Fleet::work, this, i);
+	work(0); // the calling thread is worker 0
+	for (auto& thread : threads) thread.join();
+
+	Stats total;
+	for (auto& worker : workers) {
+		total.cycles += worker->stats.cycles;
+		total.quanta += worker->stats.quanta;
+		total.steals += worker->stats.steals;
+		total.finished += worker->stats.finished;
+		worker->stats = Stats();
+	}
+	return total;
+}
+
+bool Fleet::pop( u32 worker, u32& id ) {
+	Worker& w = *workers[worker];
+	std::lock_guard<std::mutex> guard(w.lock);
+	if (w.jobs.empty()) return false;
+	id = w.jobs.front();
+	w.jobs.pop_front();
+	return true;
+}
+
+bool Fleet::steal( u32 thief, u32& id ) {
+	for (u32 i=1; i<worker_count; i++) {
+		Worker& victim = *workers[(thief + i) % worker_count];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (victim.jobs.empty()) continue;
+		id = victim.jobs.back();
+		victim.jobs.pop_back();
+		return true;
+	}
+	return false;
+}
+
+void Fleet::work( u32 worker ) {
+	Worker& self = *workers[worker];
+	while (remaining.load(std::memory_order_acquire) > 0) {
+		u32 id;
+		if (!pop(worker, id)) {
+			if (!steal(worker, id)) {
+				std::this_thread::yield();
+				continue;
+			}
+			self.stats.steals++;
+		}
+
+		if (step(*instances[id], self.stats)) {
+			self.stats.finished++;
+			remaining.fetch_sub(1, std::memory_order_acq_rel);
+		} else {
+			std::lock_guard<std::mutex> guard(self.lock);
+			self.jobs.push_back(id);
+		}
+	}
+}
+
+bool Fleet::step( Instance& instance, Stats& stats ) {
+	i32 budget = quantum;
+	if (instance.cycle_limit && instance.cycle_limit - instance.cycles < (u64)budget)
+		budget = instance.cycle_limit - instance.cycles;
+
+	u32 used = instance.cpu.execute(instance.memory, budget);
+	instance.cycles += used;
+	instance.quanta++;
+	stats.cycles += used;
+	stats.quanta++;
+
+	if ((instance.cycle_limit && instance.cycles >= instance.cycle_limit)
+		|| (instance.stop && instance.stop(instance.cpu, instance.memory)))
+		instance.done = true;
+	return instance.done;
+}
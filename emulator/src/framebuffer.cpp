@@ -0,0 +1,142 @@
+#include "framebuffer.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+
+static void write_all( int fd, const void* data, size_t size ) {
+	const byte* bytes = (const byte*)data;
+	while (size > 0) {
+		ssize_t written = ::write(fd, bytes, size);
+		if (written < 0 && errno == EINTR) continue;
+		if (written <= 0) return;
+		bytes += written;
+		size -= written;
+	}
+}
+
+Framebuffer::Framebuffer( u16 width, u16 height )
+	: columns(width), rows(height), tile_columns(width / TILE), tile_rows(height / TILE),
+	screen(width * height, 0x00), dirty(tile_columns * tile_rows, 0), image(width * height, 0x00) {
+	// a partial tile would have no dirty flag
+	if (width == 0 || height == 0 || width % TILE != 0 || height % TILE != 0)
+		throw std::invalid_argument("Framebuffer: width and height must be non-zero multiples of the tile size");
+	encoder = std::thread(&Framebuffer::work, this);
+}
+
+Framebuffer::~Framebuffer() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wakeup.notify_one();
+	encoder.join();
+}
+
+u16 Framebuffer::width() const { return columns; }
+u16 Framebuffer::height() const { return rows; }
+const byte* Framebuffer::pixels() const { return screen.data(); }
+
+void Framebuffer::stream_to( int fd ) { stream_fd = fd; }
+void Framebuffer::dump_ppm( const std::string& prefix ) { ppm_prefix = prefix; }
+
+void Framebuffer::rgb( byte pixel, byte out[3] ) {
+	out[0] = (pixel >> 5) * 255 / 7;
+	out[1] = ((pixel >> 2) & 0x07) * 255 / 7;
+	out[2] = (pixel & 0x03) * 255 / 3;
+}
+
+byte Framebuffer::read( u16 offset, u64 cycle ) {
+	(void)cycle;
+	return peek(offset);
+}
+
+byte Framebuffer::peek( u16 offset ) const { return offset < screen.size() ? screen[offset] : 0x00; }
+
+void Framebuffer::write( u16 offset, byte value, u64 cycle ) {
+	(void)cycle;
+	if (offset >= screen.size() || screen[offset] == value) return;
+	screen[offset] = value;
+	dirty[(offset / columns / TILE) * tile_columns + (offset % columns) / TILE] = 1;
+}
+
+u32 Framebuffer::end_frame( u32 number ) {
+	Frame frame;
+	frame.number = number;
+
+	// runs of dirty tiles on a row of tiles make one rectangle
+	for (u16 ty=0; ty<tile_rows; ty++) {
+		for (u16 tx=0; tx<tile_columns; tx++) {
+			if (!dirty[ty * tile_columns + tx]) continue;
+			u16 first = tx;
+			while (tx < tile_columns && dirty[ty * tile_columns + tx]) dirty[ty * tile_columns + tx++] = 0;
+
+			Rect rect{ (u16)(first * TILE), (u16)(ty * TILE), (u16)((tx - first) * TILE), (u16)TILE };
+			for (u16 y=rect.y; y<rect.y + rect.h; y++) {
+				const byte* row = &screen[y * columns + rect.x];
+				frame.data.insert(frame.data.end(), row, row + rect.w);
+			}
+			frame.rects.push_back(rect);
+		}
+	}
+
+	u32 count = frame.rects.size();
+	if (count == 0) return 0;
+	frames++;
+	rects += count;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		queue.push_back(std::move(frame));
+	}
+	wakeup.notify_one();
+	return count;
+}
+
+void Framebuffer::flush() {
+	std::unique_lock<std::mutex> guard(lock);
+	idle.wait(guard, [this] { return queue.empty() && !encoding; });
+}
+
+void Framebuffer::work() {
+	std::unique_lock<std::mutex> guard(lock);
+	while (true) {
+		wakeup.wait(guard, [this] { return stopping || !queue.empty(); });
+		// frames queued before the destructor are still written out
+		if (queue.empty()) return;
+
+		Frame frame = std::move(queue.front());
+		queue.pop_front();
+		encoding = true;
+		guard.unlock();
+		encode(frame);
+		guard.lock();
+		encoding = false;
+		idle.notify_all();
+	}
+}
+
+void Framebuffer::encode( const Frame& frame ) {
+	const byte* data = frame.data.data();
+	for (const Rect& rect : frame.rects) {
+		u32 size = rect.w * rect.h;
+		if (stream_fd >= 0) {
+			RectHeader header{ frame.number, rect };
+			write_all(stream_fd, &header, sizeof(header));
+			write_all(stream_fd, data, size);
+		}
+		for (u16 y=0; y<rect.h; y++) std::memcpy(&image[(rect.y + y) * columns + rect.x], data + y * rect.w, rect.w);
+		data += size;
+	}
+
+	if (ppm_prefix.empty()) return;
+	char name[16];
+	std::snprintf(name, sizeof(name), "%06u.ppm", frame.number);
+	FILE* file = std::fopen((ppm_prefix + name).c_str(), "wb");
+	if (!file) return;
+	std::fprintf(file, "P6\n%u %u\n255\n", columns, rows);
+	std::vector<byte> rgb_image(image.size() * 3);
+	for (u32 i=0; i<image.size(); i++) rgb(image[i], &rgb_image[i * 3]);
+	std::fwrite(rgb_image.data(), 1, rgb_image.size(), file);
+	std::fclose(file);
+}
@@ -0,0 +1,161 @@
+#include "heatmap.hpp"
+#include "cpu_impl.hpp"
+#include <cmath>
+#include <cstring>
+
+/** MemoryHeatmap */
+
+MemoryHeatmap::MemoryHeatmap( bool per_byte ) : pages(Mem::PAGES), written(Mem::MAX_MEM) {
+	if (per_byte) bytes.resize(Mem::MAX_MEM);
+}
+
+void MemoryHeatmap::enter( const CPU& cpu, const Mem& memory ) {
+	u16 pc = cpu.PC;
+	byte opcode = memory.peek(pc);
+	const OpInfo& info = op_info(opcode);
+	if (!info.name) {
+		fetch(pc, 1);
+		return;
+	}
+	fetch(pc, info.length);
+
+	byte low = memory.peek(pc + 1);
+	u16 operand = low | (memory.peek(pc + 2) << 8);
+	u16 address = 0;
+	bool data = true;
+	switch (info.mode) {
+		case ZERO_PAGE: address = low; break;
+		case ZERO_PAGE_X: address = (byte)(low + cpu.X); break;
+		case ZERO_PAGE_Y: address = (byte)(low + cpu.Y); break;
+		case ABSOLUTE: address = operand; break;
+		case ABSOLUTE_X: address = operand + cpu.X; break;
+		case ABSOLUTE_Y: address = operand + cpu.Y; break;
+		case INDEXED_INDIRECT:
+		case INDIRECT_INDEXED:
+		{
+			// the pointer is read as a word, like CPU::read_word (no zero page wrap)
+			u16 pointer = info.mode == INDEXED_INDIRECT ? (byte)(low + cpu.X) : low;
+			read(pointer);
+			read(pointer + 1);
+			address = memory.peek(pointer) | (memory.peek(pointer + 1) << 8);
+			if (info.mode == INDIRECT_INDEXED) address += cpu.Y;
+		} break;
+		case INDIRECT:
+			// JMP (ind) only reads the pointer
+			read(operand);
+			read(operand + 1);
+			data = false;
+			break;
+		default: data = false; break;
+	}
+
+	u16 stack = CPU::STACK + cpu.SP;
+	switch (opcode) {
+		case CPU::INS_JMP_AB:
+			return;
+		case CPU::INS_JSR_AB:
+			write(stack);
+			write(CPU::STACK + (byte)(cpu.SP - 1));
+			return;
+		case CPU::INS_PHA:
+		case CPU::INS_PHP:
+			write(stack);
+			return;
+		case CPU::INS_PLA:
+		case CPU::INS_PLP:
+			read(CPU::STACK + (byte)(cpu.SP + 1));
+			return;
+		case CPU::INS_RTS:
+		case CPU::INS_RTI:
+			for (u32 i=1; i<=(opcode == CPU::INS_RTS ? 2u : 3u); i++) read(CPU::STACK + (byte)(cpu.SP + i));
+			return;
+	}
+	if (!data) return;
+	if (info.name[0] == 'S' && info.name[1] == 'T') write(address);
+	else read(address);
+}
+
+const MemoryHeatmap::Counts& MemoryHeatmap::at( u16 address ) const {
+	static const Counts none;
+	return bytes.empty() ? none : bytes[address];
+}
+
+void MemoryHeatmap::reset() {
+	for (Counts& counts : pages) counts = Counts();
+	for (Counts& counts : bytes) counts = Counts();
+	std::memset(written.data(), 0, written.size());
+	fresh = 0;
+}
+
+void MemoryHeatmap::read( u16 address ) {
+	pages[address >> 8].reads++;
+	if (!bytes.empty()) bytes[address].reads++;
+}
+
+void MemoryHeatmap::write( u16 address ) {
+	pages[address >> 8].writes++;
+	if (!bytes.empty()) bytes[address].writes++;
+	written[address] = 1;
+}
+
+void MemoryHeatmap::fetch( u16 pc, byte length ) {
+	bool modified = false;
+	for (u16 i=0; i<length; i++) {
+		u16 address = pc + i;
+		pages[address >> 8].fetches++;
+		if (!bytes.empty()) bytes[address].fetches++;
+		modified |= written[address];
+		written[address] = 0;
+	}
+	if (!modified) return;
+	fresh++;
+	pages[pc >> 8].fresh++;
+	if (!bytes.empty()) bytes[pc].fresh++;
+}
+
+void MemoryHeatmap::write_heatmap( std::ostream& out ) const {
+	static const char ramp[] = " .:-=+*#%@";
+	static const char* titles[] = { "reads", "writes", "fetches", "fresh code" };
+
+	for (u32 kind=0; kind<4; kind++) {
+		auto count = [&]( u32 page ) {
+			const Counts& counts = pages[page];
+			return kind == 0 ? counts.reads : kind == 1 ? counts.writes : kind == 2 ? counts.fetches : counts.fresh;
+		};
+		u64 most = 0;
+		for (u32 page=0; page<Mem::PAGES; page++) if (count(page) > most) most = count(page);
+
+		out << std::dec << titles[kind] << " (max " << most << " per page)\n   ";
+		for (u32 column=0; column<16; column++) out << std::hex << std::uppercase << column;
+		out << "\n";
+		for (u32 row=0; row<16; row++) {
+			out << row << "0 ";
+			for (u32 column=0; column<16; column++) {
+				u64 value = count(row * 16 + column);
+				// an untouched page is blank, any other is at least '.'
+				u32 level = value ? 1 + (u32)(std::log2((double)value) / std::log2((double)most + 1) * (sizeof(ramp) - 2)) : 0;
+				out << ramp[level];
+			}
+			out << "\n";
+		}
+		out << std::dec << std::nouppercase << "\n";
+	}
+}
+
+void MemoryHeatmap::write_csv( std::ostream& out ) const {
+	out << std::dec << "page,reads,writes,fetches,fresh\n";
+	for (u32 page=0; page<Mem::PAGES; page++) {
+		const Counts& counts = pages[page];
+		if (!counts.reads && !counts.writes && !counts.fetches) continue;
+		out << page << "," << counts.reads << "," << counts.writes << "," << counts.fetches << "," << counts.fresh << "\n";
+	}
+	if (bytes.empty()) return;
+	out << "\naddress,reads,writes,fetches,fresh\n";
+	for (u32 address=0; address<Mem::MAX_MEM; address++) {
+		const Counts& counts = bytes[address];
+		if (!counts.reads && !counts.writes && !counts.fetches) continue;
+		out << address << "," << counts.reads << "," << counts.writes << "," << counts.fetches << "," << counts.fresh << "\n";
+	}
+}
+
+template u32 CPU::execute<MemoryHeatmap>( Mem& memory, i32 cycles, MemoryHeatmap& probe );
@@ -0,0 +1,196 @@
+#include "lockstep.hpp"
+
+void LockstepCPU::load( u32 lane, const CPU& cpu, Mem& memory ) {
+	PC[lane] = cpu.PC;
+	SP[lane] = cpu.SP;
+	A[lane] = cpu.A;
+	X[lane] = cpu.X;
+	Y[lane] = cpu.Y;
+	flags[lane] = cpu.flags;
+	clock[lane] = cpu.clock;
+	this->memory[lane] = &memory;
+	if (lane >= lanes) lanes = lane + 1;
+}
+
+CPU LockstepCPU::get( u32 lane ) const {
+	CPU cpu;
+	cpu.PC = PC[lane];
+	cpu.SP = SP[lane];
+	cpu.A = A[lane];
+	cpu.X = X[lane];
+	cpu.Y = Y[lane];
+	cpu.flags = flags[lane];
+	cpu.clock = clock[lane];
+	return cpu;
+}
+
+void LockstepCPU::execute( i32 cycles ) {
+	for (u32 l=0; l<MAX_LANES; l++) {
+		budget[l] = (l < lanes) ? cycles : 0;
+		used[l] = 0;
+	}
+
+	while (true) {
+		// the lowest PC leads, so lanes that branched ahead wait for the others
+		i32 leader = -1;
+		for (u32 l=0; l<lanes; l++)
+			if (budget[l] > 0 && (leader < 0 || PC[l] < PC[leader])) leader = l;
+		if (leader < 0) break;
+
+		// matching the code must not look like a guest access to a device
+		word pc = PC[leader];
+		Mem& code = *memory[leader];
+		byte opcode = code.peek(pc);
+		byte lo = code.peek(pc + 1);
+		byte hi = code.peek(pc + 2);
+
+		bool mask[MAX_LANES] = {};
+		for (u32 l=0; l<lanes; l++) {
+			Mem& m = *memory[l];
+			mask[l] = budget[l] > 0 && PC[l] == pc
+				&& m.peek(pc) == opcode && m.peek(pc + 1) == lo && m.peek(pc + 2) == hi;
+		}
+
+		// devices see the bus time of each lane, and a lane with events or an
+		// interrupt due goes through CPU::execute, which services them first
+		bool any = false;
+		for (u32 l=0; l<lanes; l++) {
+			if (!mask[l]) continue;
+			Mem& m = *memory[l];
+			m.now = clock[l];
+			if (m.now >= m.attention.load(std::memory_order_relaxed)) {
+				mask[l] = false;
+				step_scalar(l);
+			}
+			any |= mask[l];
+		}
+		if (!any) continue;
+
+		if (step_vector(opcode, lo, hi, mask)) {
+			vector_steps++;
+		} else {
+			for (u32 l=0; l<lanes; l++) if (mask[l]) step_scalar(l);
+		}
+	}
+}
+
+/**
+ * lane kernels, the cycles charged match the scalar implementation of the
+ * same instruction in CPU::execute
+ * */
+bool LockstepCPU::step_vector( byte opcode, byte lo, byte hi, const bool* mask ) {
+	word addr = lo | (hi << 8);
+
+	switch (opcode) {
+		case CPU::INS_LDA_IM: load_immediate(A, lo, mask); retire(mask, 2, 2); break;
+		case CPU::INS_LDX_IM: load_immediate(X, lo, mask); retire(mask, 2, 2); break;
+		case CPU::INS_LDY_IM: load_immediate(Y, lo, mask); retire(mask, 2, 2); break;
+
+		case CPU::INS_LDA_ZP: load_absolute(A, lo, mask); retire(mask, 2, 3); break;
+		case CPU::INS_LDX_ZP: load_absolute(X, lo, mask); retire(mask, 2, 3); break;
+		case CPU::INS_LDY_ZP: load_absolute(Y, lo, mask); retire(mask, 2, 3); break;
+
+		case CPU::INS_LDA_AB: load_absolute(A, addr, mask); retire(mask, 3, 4); break;
+		case CPU::INS_LDX_AB: load_absolute(X, addr, mask); retire(mask, 3, 4); break;
+		case CPU::INS_LDY_AB: load_absolute(Y, addr, mask); retire(mask, 3, 4); break;
+
+		case CPU::INS_STA_ZP: store_absolute(A, lo, mask); retire(mask, 2, 3); break;
+		case CPU::INS_STX_ZP: store_absolute(X, lo, mask); retire(mask, 2, 3); break;
+		case CPU::INS_STY_ZP: store_absolute(Y, lo, mask); retire(mask, 2, 3); break;
+
+		case CPU::INS_STA_AB: store_absolute(A, addr, mask); retire(mask, 3, 4); break;
+		case CPU::INS_STX_AB: store_absolute(X, addr, mask); retire(mask, 3, 4); break;
+		case CPU::INS_STY_AB: store_absolute(Y, addr, mask); retire(mask, 3, 4); break;
+
+		case CPU::INS_TAX: transfer(X, A, mask); set_register_status(X, mask); retire(mask, 1, 1); break;
+		case CPU::INS_TAY: transfer(Y, A, mask); set_register_status(Y, mask); retire(mask, 1, 1); break;
+		case CPU::INS_TXA: transfer(A, X, mask); set_register_status(A, mask); retire(mask, 1, 1); break;
+		case CPU::INS_TYA: transfer(A, Y, mask); set_register_status(A, mask); retire(mask, 1, 1); break;
+		case CPU::INS_TSX: transfer(X, SP, mask); set_register_status(X, mask); retire(mask, 1, 1); break;
+		case CPU::INS_TXS: transfer(SP, X, mask); retire(mask, 1, 1); break;
+
+		case CPU::INS_AND_IM:
+		{
+			for (u32 l=0; l<MAX_LANES; l++) A[l] = mask[l] ? (byte)(A[l] & lo) : A[l];
+			set_register_status(A, mask);
+			retire(mask, 2, 2);
+		} break;
+
+		case CPU::INS_EOR_IM:
+		{
+			for (u32 l=0; l<MAX_LANES; l++) A[l] = mask[l] ? (byte)(A[l] ^ lo) : A[l];
+			set_register_status(A, mask);
+			retire(mask, 2, 2);
+		} break;
+
+		case CPU::INS_ORA_IM:
+		{
+			for (u32 l=0; l<MAX_LANES; l++) A[l] = mask[l] ? (byte)(A[l] | lo) : A[l];
+			set_register_status(A, mask);
+			retire(mask, 2, 2);
+		} break;
+
+		case CPU::INS_JMP_AB:
+		{
+			for (u32 l=0; l<MAX_LANES; l++) PC[l] = mask[l] ? addr : PC[l];
+			retire(mask, 0, 3);
+		} break;
+
+		default: return false;
+	}
+	return true;
+}
+
+void LockstepCPU::step_scalar( u32 lane ) {
+	CPU cpu = get(lane);
+	// a single cycle budget runs exactly one instruction
+	u32 cycles = cpu.execute(*memory[lane], 1);
+	PC[lane] = cpu.PC;
+	SP[lane] = cpu.SP;
+	A[lane] = cpu.A;
+	X[lane] = cpu.X;
+	Y[lane] = cpu.Y;
+	flags[lane] = cpu.flags;
+	clock[lane] = cpu.clock;
+	budget[lane] -= cycles;
+	used[lane] += cycles;
+	scalar_steps++;
+}
+
+/** utility functions */
+
+void LockstepCPU::retire( const bool* mask, word length, i32 cycles ) {
+	for (u32 l=0; l<MAX_LANES; l++) {
+		PC[l] += mask[l] ? length : 0;
+		budget[l] -= mask[l] ? cycles : 0;
+		used[l] += mask[l] ? cycles : 0;
+		clock[l] += mask[l] ? cycles : 0;
+	}
+}
+
+void LockstepCPU::set_register_status( const byte* reg, const bool* mask ) {
+	constexpr byte NZ_MASK = CPU::ZERO_MASK | CPU::NEGATIVE_MASK;
+	for (u32 l=0; l<MAX_LANES; l++) {
+		byte status = (reg[l] == 0 ? CPU::ZERO_MASK : 0) | (reg[l] & 0x80 ? CPU::NEGATIVE_MASK : 0);
+		flags[l] = mask[l] ? (byte)((flags[l] & ~NZ_MASK) | status) : flags[l];
+	}
+}
+
+void LockstepCPU::load_immediate( byte* reg, byte value, const bool* mask ) {
+	for (u32 l=0; l<MAX_LANES; l++) reg[l] = mask[l] ? value : reg[l];
+	set_register_status(reg, mask);
+}
+
+void LockstepCPU::load_absolute( byte* reg, word addr, const bool* mask ) {
+	// every lane reads its own memory, this is a gather
+	for (u32 l=0; l<lanes; l++) if (mask[l]) reg[l] = memory[l]->read(addr);
+	set_register_status(reg, mask);
+}
+
+void LockstepCPU::store_absolute( const byte* reg, word addr, const bool* mask ) {
+	for (u32 l=0; l<lanes; l++) if (mask[l]) memory[l]->write(addr, reg[l]);
+}
+
+void LockstepCPU::transfer( byte* to, const byte* from, const bool* mask ) {
+	for (u32 l=0; l<MAX_LANES; l++) to[l] = mask[l] ? from[l] : to[l];
+}
@@ -1,8 +1,216 @@
 #include "memory.hpp"
+#include "device.hpp"
 #include <iostream>
 #include <iomanip>
+#include <cstring>
+#include <stdexcept>
 
-void Mem::initialize() { for (u32 i=0; i<MAX_MEM; i++) memory[i] = 0x0; }
+static bool zero( const byte* page ) {
+	u64 bits = 0;
+	for (u32 i=0; i<Mem::PAGE_SIZE; i+=sizeof(u64)) {
+		u64 word;
+		std::memcpy(&word, page + i, sizeof(word));
+		bits |= word;
+	}
+	return bits == 0;
+}
+
+Mem::Mem() : memory(new byte[MAX_MEM]), owned(true) { map_private(); }
+Mem::Mem( byte* backing ) : memory(backing), owned(false) { map_private(); }
+
+Mem::Mem( const Mem& other ) : memory(new byte[MAX_MEM]), owned(true) { copy_pages(other); }
+
+Mem::Mem( Mem&& other )
+	: memory(other.memory), now(other.now), attention(other.attention.load()),
+	irq_lines(other.irq_lines.load()), stall(other.stall), events(std::move(other.events)), owned(other.owned) {
+	// the page pointers point into the backing, which moves along
+	std::memcpy(pages, other.pages, sizeof(pages));
+	std::memcpy(modes, other.modes, sizeof(modes));
+	std::memcpy(shared, other.shared, sizeof(shared));
+	std::memcpy(devices, other.devices, sizeof(devices));
+	for (u32 page=0; page<PAGES; page++) if (devices[page]) devices[page]->bus = this;
+	other.memory = nullptr;
+	other.owned = false;
+}
+
+Mem& Mem::operator=( const Mem& other ) {
+	if (this != &other) {
+		copy_pages(other);
+		events.clear();
+		irq_lines.store(0, std::memory_order_relaxed);
+		stall = 0;
+		attention.store(NEVER, std::memory_order_relaxed);
+	}
+	return *this;
+}
+
+Mem::~Mem() { if (owned) delete[] memory; }
+
+void Mem::initialize() {
+	for (u32 page=0; page<PAGES; page++) {
+		if (shared[page]) {
+			pages[page] = (byte*)shared[page];
+			if (modes[page] == RAM) modes[page] = COW;
+		} else if (!zero(memory + page * PAGE_SIZE)) {
+			// reading a page that was never written does not commit it, writing would
+			std::memset(memory + page * PAGE_SIZE, 0x0, PAGE_SIZE);
+		}
+	}
+}
+
+void Mem::map_shared( u16 address, u32 size, const byte* data, PageMode mode ) {
+	if (address % PAGE_SIZE != 0 || size % PAGE_SIZE != 0 || address + size > MAX_MEM)
+		throw std::invalid_argument("Mem: a shared mapping must be whole pages inside the address space");
+	for (u32 offset=0; offset<size; offset+=PAGE_SIZE) {
+		u32 page = (address + offset) / PAGE_SIZE;
+		shared[page] = data + offset;
+		pages[page] = (byte*)(data + offset);
+		modes[page] = mode;
+	}
+}
+
+void Mem::unmap_all() {
+	map_private();
+	events.clear();
+	now = 0;
+	stall = 0;
+	irq_lines.store(0, std::memory_order_relaxed);
+	attention.store(NEVER, std::memory_order_relaxed);
+}
+
+void Mem::attach( Device& device, u16 base, u32 size ) {
+	// the device owns its pages from the start, offsets are never below base
+	if (base % PAGE_SIZE != 0 || size == 0 || base + size > MAX_MEM)
+		throw std::invalid_argument("Mem: a device must start on a page and fit the address space");
+	device.bus = this;
+	device.base = base;
+	device.size = size;
+	for (u32 page=base / PAGE_SIZE; page<(base + size + PAGE_SIZE - 1) / PAGE_SIZE; page++) {
+		pages[page] = memory + page * PAGE_SIZE;
+		modes[page] = IO;
+		shared[page] = nullptr;
+		devices[page] = &device;
+	}
+}
+
+void Mem::schedule( Device& device, u64 cycle, u32 tag ) {
+	events.push_back(Event{ cycle, &device, tag });
+	wake(cycle);
+}
+
+void Mem::cancel( Device& device, u32 tag ) {
+	// attention is left alone, an early service() only finds nothing to do
+	for (u32 i=0; i<events.size(); i++) {
+		if (events[i].device == &device && events[i].tag == tag) {
+			events[i] = events.back();
+			events.pop_back();
+			i--;
+		}
+	}
+}
+
+u64 Mem::next_event() const {
+	u64 next = NEVER;
+	for (const Event& event : events) if (event.cycle < next) next = event.cycle;
+	return next;
+}
+
+void Mem::dispatch( u64 time ) {
+	// one at a time and in order, a handler can schedule (or cancel) more events
+	while (true) {
+		i32 due = -1;
+		for (u32 i=0; i<events.size(); i++)
+			if (events[i].cycle <= time && (due < 0 || events[i].cycle < events[due].cycle)) due = i;
+		if (due < 0) break;
+
+		Event event = events[due];
+		events[due] = events.back();
+		events.pop_back();
+		event.device->catch_up(event.cycle);
+		event.device->on_event(event.cycle, event.tag);
+	}
+}
+
+void Mem::steal( u64 cycles ) {
+	stall += cycles;
+	wake(0);
+}
+
+void Mem::raise_irq( u32 line ) {
+	// wake() publishes the line with release, service() picks it up with acquire
+	irq_lines.fetch_or(1u << line, std::memory_order_relaxed);
+	wake(0);
+}
+
+void Mem::clear_irq( u32 line ) { irq_lines.fetch_and(~(1u << line), std::memory_order_relaxed); }
+
+void Mem::wake( u64 cycle ) {
+	u64 current = attention.load(std::memory_order_relaxed);
+	while (cycle < current && !attention.compare_exchange_weak(current, cycle, std::memory_order_release, std::memory_order_relaxed));
+}
+
+byte Mem::peek( u16 address ) const {
+	if (modes[address >> 8] == IO) {
+		const Device* device = devices[address >> 8];
+		return device->peek(address - device->base);
+	}
+	return pages[address >> 8][address & 0xFF];
+}
+
+void Mem::write_block( u16 address, const byte* data, u32 size ) {
+	while (size > 0) {
+		u32 page = address >> 8;
+		u32 chunk = PAGE_SIZE - (address & 0xFF);
+		if (chunk > size) chunk = size;
+
+		switch (modes[page]) {
+			case ROM: break;
+			case IO: for (u32 i=0; i<chunk; i++) write(address + i, data[i]); break;
+			case COW: privatize(page); [[fallthrough]];
+			default: std::memcpy(pages[page] + (address & 0xFF), data, chunk); break;
+		}
+		address += chunk;
+		data += chunk;
+		size -= chunk;
+	}
+}
+
+void Mem::read_block( u16 address, byte* data, u32 size ) const {
+	while (size > 0) {
+		u32 page = address >> 8;
+		u32 chunk = PAGE_SIZE - (address & 0xFF);
+		if (chunk > size) chunk = size;
+
+		if (modes[page] == IO) for (u32 i=0; i<chunk; i++) data[i] = read(address + i);
+		else std::memcpy(data, pages[page] + (address & 0xFF), chunk);
+		address += chunk;
+		data += chunk;
+		size -= chunk;
+	}
+}
+
+void Mem::move_block( u16 destination, u16 source, u32 size ) {
+	if (size == 0) return;
+	auto plain = [this]( u32 address, u32 size ) {
+		if (address + size > MAX_MEM) return false;
+		for (u32 page=address >> 8; page<=(address + size - 1) >> 8; page++)
+			if (modes[page] != RAM || pages[page] != memory + page * PAGE_SIZE) return false;
+		return true;
+	};
+	if (plain(destination, size) && plain(source, size)) {
+		std::memmove(memory + destination, memory + source, size);
+		return;
+	}
+	std::vector<byte> staging(size);
+	read_block(source, staging.data(), size);
+	write_block(destination, staging.data(), size);
+}
+
+u32 Mem::private_pages() const {
+	u32 count = 0;
+	for (u32 page=0; page<PAGES; page++) count += pages[page] == memory + page * PAGE_SIZE;
+	return count;
+}
 
 void Mem::inspect( u16 address, u16 size, u16 step ) {
 	for (int addr=address; addr<address+size && addr < (int)MAX_MEM; addr++) {
@@ -13,10 +221,65 @@ void Mem::inspect( u16 address, u16 size, u16 step ) {
 				<< std::hex << std::setfill('0') << std::setw(4) << (u16)addr << " - 0x"
 				<< std::hex << std::setfill('0') << std::setw(4) << (u16)hi_addr << "\t";
 		}
-		std::cout << std::hex << std::setfill('0') << std::setw(2) << (u16)memory[addr] << " ";
+		std::cout << std::hex << std::setfill('0') << std::setw(2) << (u16)peek(addr) << " ";
 	}
 	std::cout << std::endl;
 }
 
-byte Mem::operator[]( u16 address ) const { return memory[address]; }
-byte& Mem::operator[]( u16 address ) { return memory[address]; }
+byte Mem::operator[]( u16 address ) const { return peek(address); }
+
+void Mem::poke( u16 address, byte value ) {
+	// the shared buffer must stay intact
+	if (modes[address >> 8] != SHARED && pages[address >> 8] != memory + (address & 0xFF00)) privatize(address >> 8);
+	pages[address >> 8][address & 0xFF] = value;
+}
+
+void Mem::map_private() {
+	for (u32 page=0; page<PAGES; page++) {
+		pages[page] = memory + page * PAGE_SIZE;
+		modes[page] = RAM;
+		shared[page] = nullptr;
+		devices[page] = nullptr;
+	}
+}
+
+void Mem::copy_pages( const Mem& other ) {
+	for (u32 page=0; page<PAGES; page++) {
+		byte* own = memory + page * PAGE_SIZE;
+		modes[page] = other.modes[page] == IO ? RAM : other.modes[page];
+		shared[page] = other.shared[page];
+		devices[page] = nullptr;
+		if (other.pages[page] == other.memory + page * PAGE_SIZE) {
+			std::memcpy(own, other.pages[page], PAGE_SIZE);
+			pages[page] = own;
+		} else {
+			pages[page] = other.pages[page];
+		}
+	}
+}
+
+void Mem::privatize( u16 page ) {
+	byte* own = memory + page * PAGE_SIZE;
+	std::memcpy(own, pages[page], PAGE_SIZE);
+	pages[page] = own;
+	// a privatized ROM page is still ROM to the guest
+	if (modes[page] == COW) modes[page] = RAM;
+}
+
+void Mem::write_shared( u16 address, byte value ) {
+	if (modes[address >> 8] == IO) {
+		Device* device = devices[address >> 8];
+		device->catch_up(now);
+		device->write(address - device->base, value, now);
+		return;
+	}
+	if (modes[address >> 8] == ROM) return;
+	if (modes[address >> 8] == COW) privatize(address >> 8);
+	pages[address >> 8][address & 0xFF] = value;
+}
+
+byte Mem::read_io( u16 address ) const {
+	Device* device = devices[address >> 8];
+	device->catch_up(now);
+	return device->read(address - device->base, now);
+}
@@ -0,0 +1,87 @@
+#include "mempool.hpp"
+#include <sched.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// from <numaif.h>, without requiring libnuma
+static constexpr int MPOL_PREFERRED_NODE = 1;
+
+static void* map_arena( bool& huge_tlb ) {
+	void* base = mmap(nullptr, MemPool::ARENA_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (base != MAP_FAILED) {
+		huge_tlb = true;
+		return base;
+	}
+
+	// no reserved huge pages: over-map, keep a 2 MB aligned window and let THP back it
+	huge_tlb = false;
+	u64 size = 2 * MemPool::ARENA_SIZE;
+	byte* raw = (byte*)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == MAP_FAILED) return nullptr;
+
+	byte* aligned = (byte*)(((u64)raw + MemPool::ARENA_SIZE - 1) & ~(MemPool::ARENA_SIZE - 1));
+	if (aligned > raw) munmap(raw, aligned - raw);
+	byte* end = aligned + MemPool::ARENA_SIZE;
+	if (raw + size > end) munmap(end, raw + size - end);
+
+	madvise(aligned, MemPool::ARENA_SIZE, MADV_HUGEPAGE);
+	return aligned;
+}
+
+MemPool::~MemPool() {
+	for (Arena& arena : arena_list) munmap(arena.base, ARENA_SIZE);
+}
+
+Mem* MemPool::acquire( i32 node ) {
+	u32 n = (node == CURRENT_NODE) ? current_node() : (u32)node;
+
+	std::lock_guard<std::mutex> guard(lock);
+	if (n >= free_lists.size()) free_lists.resize(n + 1);
+	if (free_lists[n].empty()) grow(n);
+
+	Slot* slot = free_lists[n].back();
+	free_lists[n].pop_back();
+	return slot;
+}
+
+void MemPool::release( Mem* memory ) {
+	Slot* slot = static_cast<Slot*>(memory);
+	// the next user must not find the ROM, devices or interrupts of this one
+	slot->unmap_all();
+	std::lock_guard<std::mutex> guard(lock);
+	free_lists[slot->node].push_back(slot);
+}
+
+u32 MemPool::arenas() const { return arena_list.size(); }
+
+u32 MemPool::huge_tlb_arenas() const {
+	u32 count = 0;
+	for (const Arena& arena : arena_list) count += arena.huge_tlb;
+	return count;
+}
+
+u32 MemPool::current_node() {
+	unsigned cpu = 0, node = 0;
+	if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) return 0;
+	return node;
+}
+
+void MemPool::grow( u32 node ) {
+	bool huge_tlb;
+	byte* base = (byte*)map_arena(huge_tlb);
+	if (!base) throw std::runtime_error("MemPool: cannot map an arena");
+
+	// bind before the first touch so the pages are allocated on the node;
+	// this fails harmlessly on kernels without NUMA support
+	u64 mask = 1ull << (node % 64);
+	syscall(SYS_mbind, base, ARENA_SIZE, MPOL_PREFERRED_NODE, &mask, 64, 0);
+
+	arena_list.push_back(Arena{ base, huge_tlb });
+	for (u32 i=0; i<MEM_PER_ARENA; i++) {
+		slots.emplace_back(base + (MEM_PER_ARENA - 1 - i) * Mem::MAX_MEM, node);
+		free_lists[node].push_back(&slots.back());
+	}
+}
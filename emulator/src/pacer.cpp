@@ -0,0 +1,70 @@
+#include "pacer.hpp"
+#include <cerrno>
+#include <time.h>
+
+Pacer::Pacer( u64 clock_hz, u64 frame_ns, u64 spin_ns ) : clock_hz(clock_hz), frame_ns(frame_ns), spin_ns(spin_ns) {}
+
+double Pacer::Stats::mean_lateness() const { return frames ? (double)total_lateness / frames : 0.0; }
+
+u64 Pacer::now() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+Pacer::Stats Pacer::run( CPU& cpu, Mem& memory, u64 frames, FrameHandler on_frame ) {
+	Stats stats;
+	publish(stats);
+
+	u64 start = now();
+	u64 scheduled = 0;	// cycles due since the start
+	i32 budget = 0;		// carries the cycles an instruction ran over the previous frame
+
+	for (u64 frame=0; frames == 0 || frame < frames; frame++) {
+		// cycles due by the end of this frame, from the start of the run
+		u64 deadline = start + (frame + 1) * frame_ns;
+		u64 target = (u64)((unsigned __int128)clock_hz * (deadline - start) / 1000000000ull);
+		budget += (i32)(target - scheduled);
+		scheduled = target;
+		stats.cycles += cpu.resume(memory, budget);
+		stats.frames++;
+
+		bool keep_going = !on_frame || on_frame(frame);
+
+		u64 done = now();
+		if (done > deadline) stats.late_frames++;
+		wait_until(deadline, stats);
+
+		i64 lateness = (i64)(now() - deadline);
+		if (stats.frames == 1 || lateness < stats.min_lateness) stats.min_lateness = lateness;
+		if (stats.frames == 1 || lateness > stats.max_lateness) stats.max_lateness = lateness;
+		stats.total_lateness += lateness;
+		publish(stats);
+
+		if (!keep_going) break;
+	}
+
+	return stats;
+}
+
+Pacer::Stats Pacer::stats() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return published;
+}
+
+void Pacer::publish( const Stats& stats ) {
+	std::lock_guard<std::mutex> guard(lock);
+	published = stats;
+}
+
+void Pacer::wait_until( u64 deadline, Stats& stats ) {
+	u64 time = now();
+	if (time + spin_ns < deadline) {
+		// sleep on the absolute deadline, an early wake up just spins longer
+		u64 wake = deadline - spin_ns;
+		timespec ts = { (time_t)(wake / 1000000000ull), (long)(wake % 1000000000ull) };
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR);
+		stats.total_sleep += now() - time;
+	}
+	while (now() < deadline);
+}
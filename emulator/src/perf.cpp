@@ -0,0 +1,167 @@
+#include "perf.hpp"
+#include "cpu_impl.hpp"
+#include "decode.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/** HostCounters */
+
+static int open_counter( u32 type, u64 config ) {
+	perf_event_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static u64 now_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+HostCounters::HostCounters() {
+	static const struct { u32 type; u64 config; } events[COUNT] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	};
+	for (u32 i=0; i<COUNT; i++) {
+		fds[i] = open_counter(events[i].type, events[i].config);
+		if (fds[i] < 0 && reason.empty()) reason = std::string(name((Counter)i)) + ": " + std::strerror(errno);
+	}
+}
+
+HostCounters::~HostCounters() {
+	for (u32 i=0; i<COUNT; i++) if (fds[i] >= 0) close(fds[i]);
+}
+
+bool HostCounters::any() const {
+	for (u32 i=0; i<COUNT; i++) if (fds[i] >= 0) return true;
+	return false;
+}
+
+void HostCounters::start() {
+	for (u32 i=0; i<COUNT; i++) {
+		if (fds[i] < 0) continue;
+		ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+	started = now_ns();
+}
+
+HostCounters::Reading HostCounters::stop() {
+	Reading reading;
+	reading.nanoseconds = now_ns() - started;
+	for (u32 i=0; i<COUNT; i++) {
+		if (fds[i] < 0) continue;
+		ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		u64 data[3]; // value, time enabled, time running
+		if (::read(fds[i], data, sizeof(data)) != sizeof(data) || data[2] == 0) continue;
+		reading.values[i] = data[2] < data[1] ? (u64)((double)data[0] * data[1] / data[2]) : data[0];
+		reading.valid[i] = true;
+	}
+	return reading;
+}
+
+void HostCounters::read( u64 values[COUNT] ) const {
+	for (u32 i=0; i<COUNT; i++) {
+		u64 data[3];
+		values[i] = fds[i] >= 0 && ::read(fds[i], data, sizeof(data)) == sizeof(data) ? data[0] : 0;
+	}
+}
+
+const char* HostCounters::name( Counter counter ) {
+	static const char* names[COUNT] = { "cycles", "instructions", "branch-misses", "L1D-misses" };
+	return names[counter];
+}
+
+/** RunCost */
+
+double RunCost::per_instruction( HostCounters::Counter counter ) const {
+	if (!host.valid[counter] || !guest_instructions) return -1;
+	return (double)host.values[counter] / guest_instructions;
+}
+
+double RunCost::nanoseconds_per_instruction() const {
+	return guest_instructions ? (double)host.nanoseconds / guest_instructions : 0;
+}
+
+void RunCost::write( std::ostream& out ) const {
+	out << std::dec << "guest: " << guest_instructions << " instructions, " << guest_cycles << " cycles\n";
+	out << "host: " << host.nanoseconds << " ns, " << nanoseconds_per_instruction() << " ns per instruction\n";
+	for (u32 i=0; i<HostCounters::COUNT; i++) {
+		out << HostCounters::name((HostCounters::Counter)i) << ": ";
+		if (host.valid[i]) out << host.values[i] << ", " << per_instruction((HostCounters::Counter)i) << " per instruction\n";
+		else out << "unavailable\n";
+	}
+}
+
+RunCost measure( HostCounters& counters, CPU& cpu, Mem& memory, i32 cycles ) {
+	RunCost cost;
+	InstructionCount count;
+	counters.start();
+	cost.guest_cycles = cpu.execute(memory, cycles, count);
+	cost.host = counters.stop();
+	cost.guest_instructions = count.instructions;
+	return cost;
+}
+
+/** OpcodeCost */
+
+OpcodeCost::OpcodeCost( HostCounters& counters, u32 interval )
+	: counters(counters), interval(interval ? interval : 1), countdown(this->interval), table(256) {
+	// the cheapest of a few back to back reads is what a sample costs by itself
+	u64 first[HostCounters::COUNT], second[HostCounters::COUNT];
+	for (u32 i=0; i<HostCounters::COUNT; i++) overhead[i] = ~0ull;
+	for (u32 round=0; round<16; round++) {
+		counters.read(first);
+		counters.read(second);
+		for (u32 i=0; i<HostCounters::COUNT; i++) overhead[i] = std::min(overhead[i], second[i] - first[i]);
+	}
+}
+
+void OpcodeCost::sample( byte opcode ) {
+	u64 after[HostCounters::COUNT];
+	counters.read(after);
+	Totals& totals = table[opcode];
+	totals.samples++;
+	for (u32 i=0; i<HostCounters::COUNT; i++) {
+		u64 delta = after[i] - before[i];
+		totals.values[i] += delta > overhead[i] ? delta - overhead[i] : 0;
+	}
+	countdown = interval;
+}
+
+void OpcodeCost::write( std::ostream& out ) const {
+	std::vector<u32> order;
+	for (u32 opcode=0; opcode<256; opcode++) if (table[opcode].samples) order.push_back(opcode);
+	auto misses = [&]( u32 opcode ) {
+		return (double)table[opcode].values[HostCounters::BRANCH_MISSES] / table[opcode].samples;
+	};
+	std::stable_sort(order.begin(), order.end(), [&]( u32 a, u32 b ) { return misses(a) > misses(b); });
+
+	out << std::dec << "opcode\tsamples";
+	for (u32 i=0; i<HostCounters::COUNT; i++) out << "\t" << HostCounters::name((HostCounters::Counter)i);
+	out << "\n";
+	for (u32 opcode : order) {
+		const OpInfo& info = op_info(opcode);
+		out << std::hex << std::uppercase << opcode << " " << (info.name ? info.name : "???") << std::dec << std::nouppercase << "\t" << table[opcode].samples;
+		for (u32 i=0; i<HostCounters::COUNT; i++) out << "\t" << (double)table[opcode].values[i] / table[opcode].samples;
+		out << "\n";
+	}
+}
+
+template u32 CPU::execute<InstructionCount>( Mem& memory, i32 cycles, InstructionCount& probe );
+template u32 CPU::execute<OpcodeCost>( Mem& memory, i32 cycles, OpcodeCost& probe );
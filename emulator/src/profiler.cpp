@@ -0,0 +1,183 @@
+#include "profiler.hpp"
+#include "cpu_impl.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+/** SymbolTable */
+
+bool SymbolTable::load( const std::string& path ) {
+	std::ifstream file(path);
+	if (!file) return false;
+
+	std::string line;
+	while (std::getline(file, line)) {
+		std::istringstream words(line);
+		std::string first, second, third;
+		words >> first >> second >> third;
+		if (first.empty()) continue;
+
+		unsigned address;
+		if (first == "al" && std::sscanf(second.c_str(), "%x", &address) == 1) {
+			// VICE also writes "C:1234"
+			if (second.size() > 2 && second[1] == ':') std::sscanf(second.c_str() + 2, "%x", &address);
+			add(address, third[0] == '.' ? third.substr(1) : third);
+		} else if (second == "=" && std::sscanf(third.c_str(), third[0] == '$' ? "$%x" : "%x", &address) == 1) {
+			add(address, first);
+		} else if (std::sscanf(first.c_str(), first[0] == '$' ? "$%x" : "%x", &address) == 1 && !second.empty()) {
+			add(address, second);
+		}
+	}
+	return true;
+}
+
+void SymbolTable::add( u16 address, const std::string& name ) { labels[address] = name; }
+u32 SymbolTable::size() const { return labels.size(); }
+
+const std::string* SymbolTable::function( u16 address, u16* start ) const {
+	auto next = labels.upper_bound(address);
+	if (next == labels.begin()) return nullptr;
+	--next;
+	if (start) *start = next->first;
+	return &next->second;
+}
+
+std::string SymbolTable::describe( u16 address ) const {
+	char text[16];
+	u16 start;
+	const std::string* name = function(address, &start);
+	if (!name) {
+		std::snprintf(text, sizeof(text), "$%04X", address);
+		return text;
+	}
+	if (start == address) return *name;
+	std::snprintf(text, sizeof(text), "+0x%X", address - start);
+	return *name + text;
+}
+
+/** Profiler */
+
+Profiler::Profiler() : table(0x10000) {}
+
+const Profiler::Counters& Profiler::at( u16 pc ) const { return table[pc]; }
+
+u64 Profiler::total_cycles() const {
+	u64 total = 0;
+	for (const Counters& counters : table) total += counters.cycles;
+	return total;
+}
+
+void Profiler::reset() { std::fill(table.begin(), table.end(), Counters()); }
+
+std::vector<u16> Profiler::hottest( u32 count ) const {
+	std::vector<u16> addresses;
+	for (u32 pc=0; pc<table.size(); pc++) if (table[pc].instructions) addresses.push_back(pc);
+	std::sort(addresses.begin(), addresses.end(), [this]( u16 a, u16 b ) {
+		return table[a].cycles != table[b].cycles ? table[a].cycles > table[b].cycles : a < b;
+	});
+	if (addresses.size() > count) addresses.resize(count);
+	return addresses;
+}
+
+void Profiler::write_folded( std::ostream& out ) const {
+	for (u32 pc=0; pc<table.size(); pc++) {
+		if (!table[pc].cycles) continue;
+		const std::string* name = symbols.function(pc);
+		if (name) out << *name << ";";
+		out << symbols.describe(pc) << " " << table[pc].cycles << "\n";
+	}
+}
+
+// just enough of the protobuf wire format for profile.proto
+static void put_varint( std::string& out, u64 value ) {
+	while (value >= 0x80) {
+		out.push_back((char)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((char)value);
+}
+
+static void put_number( std::string& out, u32 field, u64 value ) {
+	put_varint(out, field << 3);
+	put_varint(out, value);
+}
+
+static void put_bytes( std::string& out, u32 field, const std::string& bytes ) {
+	put_varint(out, (field << 3) | 2);
+	put_varint(out, bytes.size());
+	out += bytes;
+}
+
+void Profiler::write_pprof( std::ostream& out ) const {
+	enum Field : u32 {
+		SAMPLE_TYPE = 1, SAMPLE = 2, LOCATION = 4, FUNCTION = 5, STRING_TABLE = 6,
+		PERIOD_TYPE = 11, PERIOD = 12,
+	};
+	std::vector<std::string> strings = { "", "instructions", "count", "cycles", "guest" };
+	std::map<std::string, u64> string_ids;
+	auto string_id = [&]( const std::string& text ) {
+		auto found = string_ids.find(text);
+		if (found != string_ids.end()) return found->second;
+		strings.push_back(text);
+		return string_ids[text] = strings.size() - 1;
+	};
+
+	std::string profile;
+	for (u32 type : { 1, 3 }) {
+		std::string value_type;
+		put_number(value_type, 1, type);
+		put_number(value_type, 2, 2);
+		put_bytes(profile, SAMPLE_TYPE, value_type);
+	}
+
+	// a function per label (or per address without one), a location per address
+	std::map<std::string, u64> function_ids;
+	std::string functions;
+	for (u32 pc=0; pc<table.size(); pc++) {
+		if (!table[pc].instructions) continue;
+		u16 start = pc;
+		const std::string* label = symbols.function(pc, &start);
+		std::string name = label ? *label : symbols.describe(pc);
+
+		u64 function_id = function_ids.size() + 1;
+		auto known = function_ids.find(name);
+		if (known != function_ids.end()) {
+			function_id = known->second;
+		} else {
+			function_ids[name] = function_id;
+			std::string function;
+			put_number(function, 1, function_id);
+			put_number(function, 2, string_id(name));
+			put_number(function, 3, string_id(name));
+			put_number(function, 4, 4);
+			put_number(function, 5, start);
+			put_bytes(functions, FUNCTION, function);
+		}
+
+		std::string line, location, sample;
+		put_number(line, 1, function_id);
+		put_number(line, 2, pc);
+		put_number(location, 1, pc + 1);
+		put_number(location, 3, pc);
+		put_bytes(location, 4, line);
+		put_bytes(profile, LOCATION, location);
+
+		put_number(sample, 1, pc + 1);
+		put_number(sample, 2, table[pc].instructions);
+		put_number(sample, 2, table[pc].cycles);
+		put_bytes(profile, SAMPLE, sample);
+	}
+	profile += functions;
+
+	std::string period_type;
+	put_number(period_type, 1, 3);
+	put_number(period_type, 2, 2);
+	put_bytes(profile, PERIOD_TYPE, period_type);
+	put_number(profile, PERIOD, 1);
+
+	for (const std::string& text : strings) put_bytes(profile, STRING_TABLE, text);
+	out.write(profile.data(), profile.size());
+}
+
+template u32 CPU::execute<Profiler>( Mem& memory, i32 cycles, Profiler& probe );
@@ -0,0 +1,86 @@
+#include "ring.hpp"
+#include <stdexcept>
+
+RingDevice::RingDevice( Direction direction, u16 base, u32 capacity, u32 line )
+	: direction(direction), payload_base(base), capacity(capacity), line(line) {
+	// the counters are 16 bits, a full ring must still differ from an empty one
+	if (capacity == 0 || (capacity & (capacity - 1)) != 0 || capacity > 0x8000)
+		throw std::invalid_argument("RingDevice: the capacity must be a power of two up to 32 KB");
+	if (base % Mem::PAGE_SIZE != 0 || base + capacity > Mem::MAX_MEM)
+		throw std::invalid_argument("RingDevice: the payload must start on a page inside the address space");
+}
+
+u16 RingDevice::head() const { return head_count; }
+u16 RingDevice::tail() const { return tail_count; }
+
+RingDevice::Spans RingDevice::spans( u16 from, u32 size ) {
+	// the spans point into the backing, which is only what the guest sees for private RAM
+	for (u32 page=payload_base / Mem::PAGE_SIZE; page<(payload_base + capacity + Mem::PAGE_SIZE - 1) / Mem::PAGE_SIZE; page++) {
+		if (bus->modes[page] != Mem::RAM || bus->pages[page] != bus->memory + page * Mem::PAGE_SIZE)
+			throw std::logic_error("RingDevice: the payload must be private RAM");
+	}
+	byte* payload = bus->memory + payload_base;
+	u32 start = from & (capacity - 1);
+	u32 first = start + size <= capacity ? size : capacity - start;
+	return Spans{ std::span<byte>(payload + start, first), std::span<byte>(payload, size - first) };
+}
+
+RingDevice::Spans RingDevice::readable() { return spans(tail_count, filled()); }
+RingDevice::Spans RingDevice::writable() { return spans(head_count, capacity - filled()); }
+
+u32 RingDevice::filled() const {
+	// the guest can set its counter anywhere, past a full ring there is nothing more
+	u32 size = (u16)(head_count - tail_count);
+	return size < capacity ? size : capacity;
+}
+
+void RingDevice::consume( u32 size ) { tail_count += size; }
+void RingDevice::produce( u32 size ) { head_count += size; }
+
+void RingDevice::ring_guest() {
+	status |= RANG;
+	if (control & IRQ_ENABLE) bus->raise_irq(line);
+}
+
+byte RingDevice::read( u16 offset, u64 cycle ) {
+	(void)cycle;
+	byte value = peek(offset);
+	if (offset == STATUS && (status & RANG)) {
+		status &= ~RANG;
+		bus->clear_irq(line);
+	}
+	return value;
+}
+
+byte RingDevice::peek( u16 offset ) const {
+	switch (offset) {
+		case HEAD_L:	return head_count & 0xFF;
+		case HEAD_H:	return head_count >> 8;
+		case TAIL_L:	return tail_count & 0xFF;
+		case TAIL_H:	return tail_count >> 8;
+		case STATUS:	return status;
+		case CONTROL:	return control;
+		case BASE_H:	return payload_base >> 8;
+		case PAGES:		return capacity / Mem::PAGE_SIZE;
+		default:		return 0x00;
+	}
+}
+
+void RingDevice::write( u16 offset, byte value, u64 cycle ) {
+	(void)cycle;
+	// the guest only moves its own counter
+	u16& counter = direction == TO_HOST ? head_count : tail_count;
+	byte own_low = direction == TO_HOST ? HEAD_L : TAIL_L;
+
+	if (offset == own_low) {
+		low_latch = value;
+	} else if (offset == own_low + 1) {
+		counter = (value << 8) | low_latch;
+	} else if (offset == DOORBELL) {
+		doorbells++;
+		if (on_doorbell) on_doorbell(*this);
+	} else if (offset == CONTROL) {
+		control = value;
+		if ((control & IRQ_ENABLE) && (status & RANG)) bus->raise_irq(line);
+	}
+}
@@ -0,0 +1,142 @@
+#include "sampler.hpp"
+#include <chrono>
+
+/** SampleBuffer */
+
+SampleBuffer::SampleBuffer( u32 capacity ) {
+	u32 size = 1;
+	while (size < capacity) size <<= 1;
+	ring.resize(size);
+	mask = size - 1;
+}
+
+void SampleBuffer::record( const CPU& cpu, const Mem& memory ) {
+	u32 at = head.load(std::memory_order_relaxed);
+	if (at - tail.load(std::memory_order_acquire) > mask) {
+		lost.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	Sample& sample = ring[at & mask];
+	sample.pc = cpu.PC;
+	sample.depth = 0;
+	// JSR pushes the address of its last byte, high byte first
+	u32 sp = cpu.SP + 1;
+	while (sp + 1 <= 0xFF && sample.depth < Sample::MAX_DEPTH) {
+		u16 pushed = memory.peek(CPU::STACK + sp) | (memory.peek(CPU::STACK + sp + 1) << 8);
+		u16 site = pushed - 2;
+		if (memory.peek(site) == CPU::INS_JSR_AB) {
+			sample.callers[sample.depth++] = site;
+			sp += 2;
+		} else {
+			sp++;
+		}
+	}
+
+	head.store(at + 1, std::memory_order_release);
+}
+
+void CPU::sample( Mem& memory ) {
+	if (samples->due.exchange(false, std::memory_order_acquire)) samples->record(*this, memory);
+}
+
+u32 SampleBuffer::drain( std::vector<Sample>& out ) {
+	u32 from = tail.load(std::memory_order_relaxed);
+	u32 to = head.load(std::memory_order_acquire);
+	for (u32 i=from; i!=to; i++) out.push_back(ring[i & mask]);
+	tail.store(to, std::memory_order_release);
+	return to - from;
+}
+
+/** Sampler */
+
+Sampler::Sampler( u32 period ) : period(period) {}
+
+Sampler::~Sampler() { stop(); }
+
+void Sampler::attach( CPU& cpu, Mem& memory, SampleBuffer& buffer ) {
+	std::lock_guard<std::mutex> guard(lock);
+	cpu.samples = &buffer;
+	targets.push_back(Target{ &cpu, &memory, &buffer });
+}
+
+void Sampler::detach( CPU& cpu ) {
+	std::lock_guard<std::mutex> guard(lock);
+	for (u32 i=0; i<targets.size(); i++) {
+		if (targets[i].cpu != &cpu) continue;
+		cpu.samples = nullptr;
+		targets.erase(targets.begin() + i);
+		return;
+	}
+}
+
+void Sampler::start() {
+	if (timer.joinable()) return;
+	stopping = false;
+	timer = std::thread(&Sampler::run, this);
+}
+
+void Sampler::stop() {
+	if (!timer.joinable()) return;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wakeup.notify_all();
+	timer.join();
+}
+
+void Sampler::tick() {
+	std::lock_guard<std::mutex> guard(lock);
+	for (Target& target : targets) {
+		// `due` must be visible before the CPU sees the wake up (see CPU::service)
+		target.buffer->due.store(true, std::memory_order_release);
+		target.memory->wake(0);
+	}
+	count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Sampler::run() {
+	auto next = std::chrono::steady_clock::now();
+	while (true) {
+		next += std::chrono::microseconds(period);
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			if (wakeup.wait_until(guard, next, [this] { return stopping; })) return;
+		}
+		tick();
+	}
+}
+
+/** SampleProfile */
+
+void SampleProfile::add( const std::vector<Sample>& samples ) {
+	std::vector<u16> stack;
+	for (const Sample& sample : samples) {
+		stack.clear();
+		for (u32 i=sample.depth; i>0; i--) stack.push_back(sample.callers[i - 1]);
+		stack.push_back(sample.pc);
+		stacks[stack]++;
+		total++;
+	}
+}
+
+u64 SampleProfile::at( u16 pc ) const {
+	u64 found = 0;
+	for (auto& [stack, count] : stacks) if (stack.back() == pc) found += count;
+	return found;
+}
+
+std::string SampleProfile::function( u16 address ) const {
+	const std::string* name = symbols.function(address);
+	return name ? *name : symbols.describe(address);
+}
+
+void SampleProfile::write_folded( std::ostream& out ) const {
+	for (auto& [stack, count] : stacks) {
+		for (u32 i=0; i+1<stack.size(); i++) out << function(stack[i]) << ";";
+		const std::string* name = symbols.function(stack.back());
+		if (name) out << *name << ";";
+		out << symbols.describe(stack.back()) << " " << std::dec << count << "\n";
+	}
+}
@@ -0,0 +1,175 @@
+#include "scheduler.hpp"
+#include <chrono>
+#include <thread>
+
+static constexpr u64 NO_DEADLINE = ~0ull;
+
+Scheduler::Scheduler( u32 workers, i32 quantum ) : worker_count(workers ? workers : 1), quantum(quantum) {}
+
+u32 Scheduler::add( i32 cycles_per_tick, u64 period, TickHandler on_tick ) {
+	std::lock_guard<std::mutex> guard(lock);
+	auto task = std::make_unique<Task>();
+	task->id = tasks.size();
+	task->cycles_per_tick = cycles_per_tick;
+	task->period = period;
+	task->on_tick = on_tick;
+	replenish(*task, now());
+	push_ready(*task);
+	tasks.push_back(std::move(task));
+	active++;
+	return tasks.size() - 1;
+}
+
+Scheduler::Task& Scheduler::task( u32 id ) { return *tasks[id]; }
+u32 Scheduler::size() const { return tasks.size(); }
+
+void Scheduler::park( u32 id ) {
+	std::lock_guard<std::mutex> guard(lock);
+	Task& task = *tasks[id];
+	// a running task stays RUNNING, so that an unpark() can not queue it while
+	// its worker is still inside it; the worker parks it at the end of the slice
+	if (task.state == RUNNING) task.park_requested = true;
+	else if (task.state != DONE) task.state = PARKED;
+}
+
+void Scheduler::unpark( u32 id ) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		Task& task = *tasks[id];
+		if (task.state == RUNNING) task.park_requested = false;
+		if (task.state != PARKED) return;
+		if (task.budget > 0 || task.period == 0 || task.release <= now()) push_ready(task);
+		else push_waiting(task);
+	}
+	wakeup.notify_one();
+}
+
+u64 Scheduler::now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Scheduler::run_for( u64 duration ) {
+	u64 end = now() + duration;
+	std::vector<std::thread> threads;
+	for (u32 i=1; i<worker_count; i++) threads.emplace_back(&Scheduler::work, this, end);
+	work(end); // the calling thread is a worker too
+	for (auto& thread : threads) thread.join();
+}
+
+void Scheduler::work( u64 end ) {
+	std::unique_lock<std::mutex> guard(lock);
+
+	while (active > 0) {
+		u64 time = now();
+		if (time >= end) break;
+
+		release_due(time);
+		u32 id;
+		if (!pop_ready(id)) {
+			// sleep until the next release, an unpark or the end of the run
+			u64 until = end;
+			if (!waiting.empty() && waiting.top().key < until) until = waiting.top().key;
+			wakeup.wait_for(guard, std::chrono::nanoseconds(until - time));
+			continue;
+		}
+
+		Task& task = *tasks[id];
+		task.state = RUNNING;
+		i32 slice = task.budget < quantum ? task.budget : quantum;
+		guard.unlock();
+
+		u32 used = task.cpu.resume(task.memory, slice);
+
+		guard.lock();
+		task.budget -= used;
+		task.cycles += used;
+		if (settle_park(task)) continue;
+
+		if (task.budget > 0) {
+			push_ready(task);
+			continue;
+		}
+
+		complete_tick(task, now());
+		if (task.on_tick) {
+			guard.unlock();
+			bool keep_going = task.on_tick(task);
+			guard.lock();
+			if (!keep_going) {
+				task.state = DONE;
+				task.park_requested = false;
+				active--;
+				wakeup.notify_all();
+				continue;
+			}
+		}
+		if (settle_park(task)) continue;
+		if (task.release <= now()) push_ready(task);
+		else push_waiting(task);
+	}
+
+	wakeup.notify_all();
+}
+
+/** queues */
+
+void Scheduler::push_ready( Task& task ) {
+	task.state = READY;
+	ready.push(Entry{ task.deadline, task.cycles, task.id, ++task.seq });
+	wakeup.notify_one();
+}
+
+void Scheduler::push_waiting( Task& task ) {
+	task.state = WAITING;
+	waiting.push(Entry{ task.release, task.cycles, task.id, ++task.seq });
+}
+
+void Scheduler::replenish( Task& task, u64 release ) {
+	// an overspent budget is paid back from the new one
+	task.budget += task.cycles_per_tick;
+	task.release = release;
+	task.deadline = task.period ? release + task.period : NO_DEADLINE;
+}
+
+void Scheduler::release_due( u64 time ) {
+	while (!waiting.empty() && waiting.top().key <= time) {
+		Entry entry = waiting.top();
+		waiting.pop();
+		Task& task = *tasks[entry.id];
+		if (task.state != WAITING || task.seq != entry.seq) continue;
+		push_ready(task);
+	}
+}
+
+bool Scheduler::pop_ready( u32& id ) {
+	while (!ready.empty()) {
+		Entry entry = ready.top();
+		ready.pop();
+		Task& task = *tasks[entry.id];
+		// skip entries left behind by park()/unpark()
+		if (task.state != READY || task.seq != entry.seq) continue;
+		id = entry.id;
+		return true;
+	}
+	return false;
+}
+
+void Scheduler::complete_tick( Task& task, u64 time ) {
+	task.ticks++;
+	if (task.period == 0) {
+		replenish(task, time);
+		return;
+	}
+	if (time > task.deadline) task.missed++;
+	// the next period starts where this one was supposed to end, so there is
+	// no drift; a late task is released right away
+	replenish(task, task.deadline);
+}
+
+bool Scheduler::settle_park( Task& task ) {
+	if (!task.park_requested) return false;
+	task.park_requested = false;
+	task.state = PARKED;
+	return true;
+}
@@ -0,0 +1,301 @@
+#include "shard.hpp"
+#include <new>
+#include <sched.h>
+#include <signal.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static_assert(std::atomic<u32>::is_always_lock_free, "shared rings need address-free atomics");
+
+static void backoff( u32& spins ) {
+	if (spins++ < 64) {
+		sched_yield();
+	} else {
+		timespec pause = { 0, 100000 }; // 100 us
+		nanosleep(&pause, nullptr);
+	}
+}
+
+static u64 align_up( u64 size, u64 alignment ) { return (size + alignment - 1) & ~(alignment - 1); }
+
+/** SharedRing */
+
+u32 SharedRing::footprint( u32 capacity ) {
+	return align_up(sizeof(Header) + capacity * sizeof(Cell), 64);
+}
+
+void SharedRing::create( void* at, u32 capacity ) {
+	header = new (at) Header;
+	header->mask = capacity - 1;
+	header->head.store(0, std::memory_order_relaxed);
+	header->tail.store(0, std::memory_order_relaxed);
+	cells = (Cell*)((byte*)at + sizeof(Header));
+	for (u32 i=0; i<capacity; i++) {
+		new (&cells[i]) Cell;
+		cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+}
+
+static u64 make_claim( u32 position, u32 value ) { return (u64)position << 32 | value; }
+
+bool SharedRing::push( u32 value, Claim* claim ) {
+	u32 pos = header->tail.load(std::memory_order_relaxed);
+	while (true) {
+		Cell& cell = cells[pos & header->mask];
+		i32 diff = (i32)(cell.sequence.load(std::memory_order_acquire) - pos);
+		if (diff == 0) {
+			if (claim) claim->store(make_claim(pos, value));
+			if (header->tail.compare_exchange_weak(pos, pos + 1)) {
+				cell.value.store(value, std::memory_order_relaxed);
+				cell.sequence.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+		} else if (diff < 0) {
+			return false; // full
+		} else {
+			pos = header->tail.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+bool SharedRing::pop( u32& value, Claim* claim ) {
+	u32 pos = header->head.load(std::memory_order_relaxed);
+	while (true) {
+		Cell& cell = cells[pos & header->mask];
+		i32 diff = (i32)(cell.sequence.load(std::memory_order_acquire) - (pos + 1));
+		if (diff == 0) {
+			// read before taking the position, so the claim carries it; if the
+			// cell is recycled meanwhile the exchange fails and it is read again
+			u32 candidate = cell.value.load(std::memory_order_relaxed);
+			if (claim) claim->store(make_claim(pos, candidate));
+			if (header->head.compare_exchange_weak(pos, pos + 1)) {
+				value = candidate;
+				cell.sequence.store(pos + header->mask + 1, std::memory_order_release);
+				return true;
+			}
+		} else if (diff < 0) {
+			if (claim) claim->store(NO_CLAIM);
+			return false; // empty
+		} else {
+			pos = header->head.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+bool SharedRing::pushed( u32 position ) const { return (i32)(header->tail.load() - position) > 0; }
+bool SharedRing::popped( u32 position ) const { return (i32)(header->head.load() - position) > 0; }
+
+void SharedRing::complete_push( u32 position, u32 value ) {
+	Cell& cell = cells[position & header->mask];
+	if (!pushed(position) || cell.sequence.load(std::memory_order_acquire) != position) return;
+	cell.value.store(value, std::memory_order_relaxed);
+	cell.sequence.store(position + 1, std::memory_order_release);
+}
+
+void SharedRing::release_pop( u32 position ) {
+	u32 taken = position + 1;
+	cells[position & header->mask].sequence.compare_exchange_strong(taken, position + header->mask + 1);
+}
+
+/** ShardPool */
+
+ShardPool::ShardPool( u32 workers, u32 slots ) : slots(slots) {
+	if (slots > SLOT_MASK + 1) throw std::invalid_argument("ShardPool: too many slots");
+	u32 capacity = 1;
+	while (capacity < slots) capacity <<= 1;
+
+	u64 control_size = align_up(sizeof(Control), 64);
+	u64 claims_size = align_up(workers * sizeof(Claims), 64);
+	u64 ring_size = SharedRing::footprint(capacity);
+	u64 rings_offset = control_size + claims_size;
+	u64 jobs_offset = rings_offset + 2 * ring_size;
+	segment_size = align_up(jobs_offset + slots * sizeof(Job), 4096);
+
+	segment = mmap(nullptr, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (segment == MAP_FAILED) throw std::runtime_error("ShardPool: cannot map the shared segment");
+
+	byte* base = (byte*)segment;
+	control = new (base) Control;
+	control->shutdown.store(0);
+	claims = (Claims*)(base + control_size);
+	for (u32 i=0; i<workers; i++) {
+		new (&claims[i]) Claims;
+		claims[i].popping.store(SharedRing::NO_CLAIM);
+		claims[i].pushing.store(SharedRing::NO_CLAIM);
+	}
+	jobs_queue.create(base + rings_offset, capacity);
+	done_queue.create(base + rings_offset + ring_size, capacity);
+	jobs = (Job*)(base + jobs_offset);
+	for (u32 i=0; i<slots; i++) {
+		new (&jobs[i]) Job;
+		jobs[i].status.store(FREE);
+		free_slots.push_back(slots - 1 - i);
+	}
+	collected.resize(slots, 0);
+
+	this->workers.resize(workers);
+	for (u32 i=0; i<workers; i++) spawn(i);
+}
+
+ShardPool::~ShardPool() {
+	control->shutdown.store(1, std::memory_order_release);
+
+	// idle workers leave on their own, the ones stuck in a long job are killed
+	for (u32 attempt=0; attempt<100; attempt++) {
+		bool alive = false;
+		for (pid_t& pid : workers) {
+			if (pid > 0 && waitpid(pid, nullptr, WNOHANG) == pid) pid = 0;
+			alive |= pid > 0;
+		}
+		if (!alive) break;
+		timespec pause = { 0, 10000000 }; // 10 ms
+		nanosleep(&pause, nullptr);
+	}
+	for (pid_t pid : workers) {
+		if (pid <= 0) continue;
+		kill(pid, SIGKILL);
+		waitpid(pid, nullptr, 0);
+	}
+
+	munmap(segment, segment_size);
+}
+
+ShardPool::Job* ShardPool::acquire() {
+	if (free_slots.empty()) return nullptr;
+	Job* job = &jobs[free_slots.back()];
+	free_slots.pop_back();
+	return job;
+}
+
+bool ShardPool::submit( Job* job ) {
+	for (u32 page=0; page<Mem::PAGES; page++) {
+		if (job->memory.modes[page] != Mem::RAM || job->memory.shared[page])
+			throw std::invalid_argument("ShardPool: a job's Mem can only have private RAM pages");
+	}
+	job->used = 0;
+	job->ticket = next_ticket++;
+	job->status.store(QUEUED, std::memory_order_release);
+	return jobs_queue.push(queue_entry(*job));
+}
+
+ShardPool::Job* ShardPool::collect( bool wait ) {
+	u32 spins = 0;
+	while (true) {
+		u32 slot;
+		bool found = done_queue.pop(slot);
+		if (!found) {
+			reap();
+			found = done_queue.pop(slot);
+		}
+		if (found) {
+			// a job recovered from a dead worker can be delivered twice
+			Job& job = jobs[slot];
+			u32 status = job.status.load(std::memory_order_acquire);
+			if ((status != DONE && status != FAILED) || collected[slot] == job.ticket) continue;
+			collected[slot] = job.ticket;
+			return &job;
+		}
+		if (!wait) return nullptr;
+		backoff(spins);
+	}
+}
+
+void ShardPool::release( Job* job ) {
+	job->status.store(FREE, std::memory_order_relaxed);
+	free_slots.push_back(job - jobs);
+}
+
+pid_t ShardPool::worker_pid( u32 worker ) const { return workers[worker]; }
+u32 ShardPool::respawned() const { return respawn_count; }
+
+void ShardPool::spawn( u32 worker ) {
+	pid_t pid = fork();
+	if (pid < 0) throw std::runtime_error("ShardPool: cannot fork a worker");
+	if (pid == 0) work(worker);
+	workers[worker] = pid;
+}
+
+void ShardPool::reap() {
+	for (u32 i=0; i<workers.size(); i++) {
+		if (waitpid(workers[i], nullptr, WNOHANG) != workers[i]) continue;
+
+		recover(i);
+		spawn(i);
+		respawn_count++;
+	}
+}
+
+u32 ShardPool::queue_entry( const Job& job ) const {
+	return job.ticket << SLOT_BITS | (u32)(&job - jobs);
+}
+
+void ShardPool::recover( u32 worker ) {
+	auto claimed_by_others = [&]( SharedRing::Claim Claims::* kind, u32 position ) {
+		for (u32 i=0; i<workers.size(); i++) {
+			u64 claim = (claims[i].*kind).load();
+			if (i != worker && claim != SharedRing::NO_CLAIM && SharedRing::claim_position(claim) == position) return true;
+		}
+		return false;
+	};
+
+	// died between popping a job and marking it RUNNING: the job goes back in the queue
+	u64 claim = claims[worker].popping.load();
+	if (claim != SharedRing::NO_CLAIM) {
+		u32 position = SharedRing::claim_position(claim), entry = SharedRing::claim_value(claim);
+		// a live worker that took the position keeps its claim until the job is RUNNING;
+		// the ticket tells a stale claim from the same slot queued again since
+		if (jobs_queue.popped(position) && !claimed_by_others(&Claims::popping, position)) {
+			jobs_queue.release_pop(position);
+			Job& job = jobs[entry & SLOT_MASK];
+			if (job.status.load(std::memory_order_acquire) == QUEUED && queue_entry(job) == entry) jobs_queue.push(entry);
+		}
+	}
+
+	// died halfway through handing a result back
+	claim = claims[worker].pushing.load();
+	if (claim != SharedRing::NO_CLAIM && !claimed_by_others(&Claims::pushing, SharedRing::claim_position(claim)))
+		done_queue.complete_push(SharedRing::claim_position(claim), SharedRing::claim_value(claim));
+
+	for (u32 slot=0; slot<slots; slot++) {
+		Job& job = jobs[slot];
+		if (job.worker.load() != worker) continue;
+		u32 status = job.status.load(std::memory_order_acquire);
+		if (status == RUNNING) {
+			// the job the worker was running is lost, report it
+			job.status.store(FAILED, std::memory_order_release);
+			done_queue.push(slot);
+		} else if (status == DONE) {
+			// finished, maybe not handed back: collect() skips it if it was
+			done_queue.push(slot);
+		}
+	}
+
+	claims[worker].popping.store(SharedRing::NO_CLAIM);
+	claims[worker].pushing.store(SharedRing::NO_CLAIM);
+}
+
+void ShardPool::work( u32 worker ) {
+	u32 spins = 0;
+	while (!control->shutdown.load(std::memory_order_acquire)) {
+		u32 slot;
+		if (!jobs_queue.pop(slot, &claims[worker].popping)) {
+			backoff(spins);
+			continue;
+		}
+		spins = 0;
+
+		slot &= SLOT_MASK;
+		Job& job = jobs[slot];
+		job.worker.store(worker, std::memory_order_relaxed);
+		job.status.store(RUNNING, std::memory_order_release);
+		claims[worker].popping.store(SharedRing::NO_CLAIM);
+		job.used = job.cpu.execute(job.memory, job.cycles);
+		job.status.store(DONE, std::memory_order_release);
+		while (!done_queue.push(slot, &claims[worker].pushing)) backoff(spins);
+		claims[worker].pushing.store(SharedRing::NO_CLAIM);
+	}
+	_exit(0);
+}
@@ -0,0 +1,59 @@
+#include "stats.hpp"
+#include "cpu_impl.hpp"
+
+/** Statistics */
+
+Statistics::Statistics() {
+	reset();
+	for (u32 i=0; i<256; i++) stack[i] = 0;
+	stack[CPU::INS_PHA] = 1;
+	stack[CPU::INS_PHP] = 1;
+	stack[CPU::INS_JSR_AB] = 2;
+	stack[CPU::INS_PLA] = -1;
+	stack[CPU::INS_PLP] = -1;
+	stack[CPU::INS_RTS] = -2;
+	stack[CPU::INS_RTI] = -3;
+}
+
+Statistics::Snapshot Statistics::snapshot() const {
+	Snapshot snapshot;
+	snapshot.instructions = instructions.load(std::memory_order_relaxed);
+	snapshot.cycles = cycles.load(std::memory_order_relaxed);
+	snapshot.page_crosses = page_crosses.load(std::memory_order_relaxed);
+	snapshot.pushes = pushes.load(std::memory_order_relaxed);
+	snapshot.pulls = pulls.load(std::memory_order_relaxed);
+	snapshot.unknown = unknown.load(std::memory_order_relaxed);
+	for (u32 i=0; i<256; i++) snapshot.opcodes[i] = opcodes[i].load(std::memory_order_relaxed);
+	for (u32 i=0; i<MODES; i++) snapshot.modes[i] = modes[i].load(std::memory_order_relaxed);
+	return snapshot;
+}
+
+void Statistics::reset() {
+	instructions = 0;
+	cycles = 0;
+	page_crosses = 0;
+	pushes = 0;
+	pulls = 0;
+	unknown = 0;
+	for (u32 i=0; i<256; i++) opcodes[i] = 0;
+	for (u32 i=0; i<MODES; i++) modes[i] = 0;
+}
+
+void Statistics::Snapshot::write( std::ostream& out ) const {
+	static const char* mode_names[MODES] = {
+		"implied", "immediate", "zero page", "zero page,X", "zero page,Y",
+		"absolute", "absolute,X", "absolute,Y", "indirect", "(indirect,X)", "(indirect),Y",
+	};
+	out << std::dec << "instructions: " << instructions << "\ncycles: " << cycles
+		<< "\npage crosses: " << page_crosses << "\npushes: " << pushes << "\npulls: " << pulls
+		<< "\nunknown opcodes: " << unknown << "\n";
+	for (u32 i=0; i<MODES; i++) if (modes[i]) out << mode_names[i] << ": " << modes[i] << "\n";
+	for (u32 i=0; i<256; i++) {
+		if (!opcodes[i]) continue;
+		const char* name = op_info(i).name;
+		out << std::hex << std::uppercase << i << " " << (name ? name : "???") << std::dec << std::nouppercase
+			<< ": " << opcodes[i] << "\n";
+	}
+}
+
+template u32 CPU::execute<Statistics>( Mem& memory, i32 cycles, Statistics& probe );
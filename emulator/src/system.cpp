@@ -0,0 +1,109 @@
+#include "system.hpp"
+#include "decode.hpp"
+#include <stdexcept>
+
+System::System( u32 cpus, u16 shared_base, u32 shared_size, Interleave mode )
+	: mode(mode), shared_base(shared_base), shared_size(shared_size), shared_ram(shared_size, 0x0) {
+	// whole pages are mapped onto the buffer, a partial one would reach past it
+	if (shared_base % Mem::PAGE_SIZE || shared_size % Mem::PAGE_SIZE || shared_base + shared_size > Mem::MAX_MEM)
+		throw std::invalid_argument("System: the shared window must be whole pages inside the address space");
+	for (u32 i=0; i<cpus; i++) {
+		auto node = std::make_unique<Node>();
+		node->memory.initialize();
+		node->memory.map_shared(shared_base, shared_size, shared_ram.data(), Mem::SHARED);
+		nodes.push_back(std::move(node));
+	}
+}
+
+System::Node& System::node( u32 index ) { return *nodes[index]; }
+u32 System::size() const { return nodes.size(); }
+byte* System::shared() { return shared_ram.data(); }
+
+void System::run( u64 cycles ) {
+	u64 start = ~0ull;
+	for (auto& node : nodes) if (node->time < start) start = node->time;
+	u64 end = start + cycles;
+
+	while (true) {
+		i32 next = -1;
+		for (u32 i=0; i<nodes.size(); i++)
+			if (nodes[i]->time < end && (next < 0 || nodes[i]->time < nodes[next]->time)) next = i;
+		if (next < 0) break;
+
+		Node& node = *nodes[next];
+		switches++;
+		// the first instruction is always allowed: this node is the furthest behind
+		do {
+			node.time += node.cpu.execute(node.memory, 1);
+		} while (mode == SHARED_ACCESS && node.time < end && (!touches_shared(node) || goes_first(next)));
+	}
+}
+
+bool System::goes_first( u32 index ) const {
+	const Node& self = *nodes[index];
+	for (u32 i=0; i<nodes.size(); i++) {
+		if (i == index) continue;
+		u64 time = nodes[i]->time;
+		if (time < self.time || (time == self.time && i < index)) return false;
+	}
+	return true;
+}
+
+bool System::is_shared( u16 address ) const {
+	return address >= shared_base && (u32)address < shared_base + shared_size;
+}
+
+bool System::touches_shared( const Node& node ) const {
+	const CPU& cpu = node.cpu;
+	const Mem& memory = node.memory;
+
+	// the step may take an interrupt instead (service() runs when an event is due
+	// or a line is up): it pushes PC and flags and reads the vector
+	if (!cpu.I && (memory.irq() || memory.next_event() <= cpu.clock)) {
+		for (u32 i=0; i<3; i++) if (is_shared(CPU::STACK + (byte)(cpu.SP - i))) return true;
+		if (is_shared(CPU::IRQ_VECTOR) || is_shared(CPU::IRQ_VECTOR + 1)) return true;
+	}
+
+	byte opcode = memory.peek(cpu.PC);
+	const OpInfo& info = op_info(opcode);
+	for (u32 i=0; i<info.length; i++) if (is_shared(cpu.PC + i)) return true;
+
+	switch (opcode) {
+		case CPU::INS_PHA: case CPU::INS_PHP: case CPU::INS_PLA: case CPU::INS_PLP:
+		case CPU::INS_JSR_AB: case CPU::INS_RTS:
+			return is_shared(CPU::STACK + (byte)(cpu.SP - 1)) || is_shared(CPU::STACK + cpu.SP)
+				|| is_shared(CPU::STACK + (byte)(cpu.SP + 1)) || is_shared(CPU::STACK + (byte)(cpu.SP + 2));
+		case CPU::INS_RTI:
+			return is_shared(CPU::STACK + (byte)(cpu.SP + 1)) || is_shared(CPU::STACK + (byte)(cpu.SP + 2))
+				|| is_shared(CPU::STACK + (byte)(cpu.SP + 3));
+		case CPU::INS_JMP_AB:
+			return false; // the target is fetched by the next instruction
+	}
+
+	word operand = memory.peek(cpu.PC + 1);
+	if (info.length > 2) operand |= memory.peek(cpu.PC + 2) << 8;
+
+	switch (info.mode) {
+		case ZERO_PAGE:		return is_shared(operand);
+		case ZERO_PAGE_X:	return is_shared((byte)(operand + cpu.X));
+		case ZERO_PAGE_Y:	return is_shared((byte)(operand + cpu.Y));
+		case ABSOLUTE:		return is_shared(operand);
+		case ABSOLUTE_X:	return is_shared(operand + cpu.X);
+		case ABSOLUTE_Y:	return is_shared(operand + cpu.Y);
+		case INDIRECT:		return is_shared(operand) || is_shared(operand + 1);
+		case INDEXED_INDIRECT:
+		{
+			// like CPU::read_word, the pointer is not wrapped inside the zero page
+			byte pointer = operand + cpu.X;
+			if (is_shared(pointer) || is_shared(pointer + 1)) return true;
+			return is_shared(memory.peek(pointer) | (memory.peek(pointer + 1) << 8));
+		}
+		case INDIRECT_INDEXED:
+		{
+			if (is_shared(operand) || is_shared(operand + 1)) return true;
+			word target = memory.peek(operand) | (memory.peek(operand + 1) << 8);
+			return is_shared(target + cpu.Y);
+		}
+		default:			return false;
+	}
+}
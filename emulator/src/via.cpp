@@ -0,0 +1,147 @@
+#include "via.hpp"
+
+Via::Via( u32 line ) : line(line) {}
+
+u16 Via::timer1( u64 cycle ) const {
+	// a reload happens the cycle after the underflow, which still reads 0xFFFF
+	if (cycle < t1_start) return 0xFFFF;
+	return (u16)(t1_value - (cycle - t1_start));
+}
+
+u16 Via::timer2( u64 cycle ) const {
+	if (acr & ACR_T2_PULSES) return t2_value;
+	return (u16)(t2_value - (cycle - t2_start));
+}
+
+byte Via::read( u16 offset, u64 cycle ) {
+	byte value = read_register(offset, cycle);
+	if (offset == T1C_L) clear_flags(IRQ_T1);
+	if (offset == T2C_L) clear_flags(IRQ_T2);
+	return value;
+}
+
+byte Via::peek( u16 offset ) const { return read_register(offset, bus ? bus->now : 0); }
+
+byte Via::read_register( u16 offset, u64 cycle ) const {
+	switch (offset) {
+		case ORB:		return (orb & ddrb) | (port_b_in & ~ddrb);
+		case ORA:
+		case ORA_NH:	return (ora & ddra) | (port_a_in & ~ddra);
+		case DDRB:		return ddrb;
+		case DDRA:		return ddra;
+		case T1C_L:		return timer1(cycle) & 0xFF;
+		case T1C_H:		return timer1(cycle) >> 8;
+		case T1L_L:		return t1_latch & 0xFF;
+		case T1L_H:		return t1_latch >> 8;
+		case T2C_L:		return timer2(cycle) & 0xFF;
+		case T2C_H:		return timer2(cycle) >> 8;
+		case SR:		return sr;
+		case ACR:		return acr;
+		case PCR:		return pcr;
+		case IFR:		return ifr | ((ifr & ier) ? IRQ_ANY : 0x00);
+		case IER:		return ier | IRQ_ANY;
+		default:		return 0x00;
+	}
+}
+
+void Via::write( u16 offset, byte value, u64 cycle ) {
+	switch (offset) {
+		case ORB:		orb = value; break;
+		case ORA:
+		case ORA_NH:	ora = value; break;
+		case DDRB:		ddrb = value; break;
+		case DDRA:		ddra = value; break;
+		case T1C_L:
+		case T1L_L:		t1_latch = (t1_latch & 0xFF00) | value; break;
+		case T1C_H:
+		{
+			// loads the counter from the latch and starts the timer
+			t1_latch = (t1_latch & 0x00FF) | (value << 8);
+			clear_flags(IRQ_T1);
+			load_timer1(t1_latch, cycle);
+		} break;
+		case T1L_H:
+		{
+			t1_latch = (t1_latch & 0x00FF) | (value << 8);
+			clear_flags(IRQ_T1);
+		} break;
+		case T2C_L:		t2_latch_low = value; break;
+		case T2C_H:
+		{
+			clear_flags(IRQ_T2);
+			load_timer2((value << 8) | t2_latch_low, cycle);
+		} break;
+		case SR:		sr = value; break;
+		case ACR:
+		{
+			bool was_counting = !(acr & ACR_T2_PULSES);
+			acr = value;
+			if (was_counting && (acr & ACR_T2_PULSES)) {
+				// there are no pulses, the counter stops where it is
+				t2_value = (u16)(t2_value - (cycle - t2_start));
+				t2_armed = false;
+				bus->cancel(*this, T2_UNDERFLOW);
+			}
+			if (!was_counting && !(acr & ACR_T2_PULSES)) load_timer2(t2_value, cycle);
+			// free-running interrupts on every underflow, even after a one shot went off
+			if ((acr & ACR_T1_CONTINUOUS) && !t1_armed) {
+				t1_armed = true;
+				bus->schedule(*this, cycle + timer1(cycle) + 1, T1_UNDERFLOW);
+			}
+		} break;
+		case PCR:		pcr = value; break;
+		case IFR:		clear_flags(value & ~IRQ_ANY); break;
+		case IER:
+		{
+			if (value & IRQ_ANY) ier |= value & ~IRQ_ANY;
+			else ier &= ~value;
+			set_flags(0x00);
+		} break;
+	}
+}
+
+void Via::on_event( u64 cycle, u32 tag ) {
+	if (tag == T1_UNDERFLOW && t1_armed) {
+		t1_underflows++;
+		set_flags(IRQ_T1);
+		if (acr & ACR_T1_CONTINUOUS) {
+			// reloads from the latch on the next cycle
+			t1_value = t1_latch;
+			t1_start = cycle + 1;
+			bus->schedule(*this, t1_start + t1_value + 1, T1_UNDERFLOW);
+		} else {
+			t1_armed = false;
+		}
+	} else if (tag == T2_UNDERFLOW && t2_armed) {
+		t2_underflows++;
+		t2_armed = false;
+		set_flags(IRQ_T2);
+	}
+}
+
+void Via::load_timer1( u16 value, u64 cycle ) {
+	t1_value = value;
+	t1_start = cycle;
+	t1_armed = true;
+	bus->cancel(*this, T1_UNDERFLOW);
+	bus->schedule(*this, cycle + value + 1, T1_UNDERFLOW);
+}
+
+void Via::load_timer2( u16 value, u64 cycle ) {
+	t2_value = value;
+	t2_start = cycle;
+	bus->cancel(*this, T2_UNDERFLOW);
+	t2_armed = !(acr & ACR_T2_PULSES);
+	if (t2_armed) bus->schedule(*this, cycle + value + 1, T2_UNDERFLOW);
+}
+
+void Via::set_flags( byte flags ) {
+	ifr |= flags;
+	if (ifr & ier) bus->raise_irq(line);
+	else bus->clear_irq(line);
+}
+
+void Via::clear_flags( byte flags ) {
+	ifr &= ~flags;
+	set_flags(0x00);
+}
@@ -134,6 +134,110 @@ void test_jump_instructions() {
 	RUN_TEST(RTS_works);
 }
 
+void test_fleet() {
+	RUN_TEST(Fleet_runs_instances_up_to_their_cycle_limit);
+	RUN_TEST(Fleet_stops_instances_on_their_stop_condition);
+	RUN_TEST(Fleet_rejects_an_empty_quantum);
+}
+
+void test_lockstep() {
+	RUN_TEST(Lockstep_matches_scalar_execution);
+	RUN_TEST(Lockstep_peels_diverging_lanes);
+	RUN_TEST(Lockstep_services_devices_like_scalar_execution);
+}
+
+void test_scheduler() {
+	RUN_TEST(CPU_resume_carries_overspent_cycles);
+	RUN_TEST(Scheduler_shares_cycles_fairly);
+	RUN_TEST(Scheduler_does_not_run_parked_tasks);
+	RUN_TEST(Scheduler_unpark_of_a_running_task_cancels_the_park);
+	RUN_TEST(Scheduler_releases_ticks_once_per_period);
+}
+
+void test_shard() {
+	RUN_TEST(ShardPool_runs_jobs_in_worker_processes);
+	RUN_TEST(ShardPool_reports_jobs_of_crashed_workers);
+	RUN_TEST(SharedRing_recovers_claims_of_a_dead_process);
+	RUN_TEST(ShardPool_only_ships_private_ram);
+}
+
+void test_memory() {
+	RUN_TEST(Mem_copies_are_deep);
+	RUN_TEST(MemPool_hands_out_memory_from_2MB_arenas);
+	RUN_TEST(MemPool_recycles_slots_unmapped);
+	RUN_TEST(Mem_rejects_partial_shared_mappings);
+	RUN_TEST(Mem_rejects_misplaced_devices);
+	RUN_TEST(Mem_shares_ROM_pages_and_drops_writes);
+	RUN_TEST(Mem_copies_COW_pages_on_first_write);
+	RUN_TEST(Mem_host_reads_do_not_copy_shared_pages);
+}
+
+void test_decode() {
+	RUN_TEST(op_info_matches_the_cycles_charged_by_execute);
+}
+
+void test_async() {
+	RUN_TEST(SpscRing_keeps_order_and_capacity);
+	RUN_TEST(AsyncMachine_answers_commands_in_order);
+	RUN_TEST(AsyncMachine_peeks_without_reading_devices);
+	RUN_TEST(AsyncMachine_stop_interrupts_a_long_run);
+}
+
+void test_pacer() {
+	RUN_TEST(Pacer_keeps_the_guest_clock_rate);
+	RUN_TEST(Pacer_stops_when_the_frame_handler_says_so);
+}
+
+void test_system() {
+	RUN_TEST(System_shares_RAM_between_CPUs);
+	RUN_TEST(System_rejects_partial_shared_pages);
+	RUN_TEST(System_sees_the_stack_accesses_of_interrupts_and_RTI);
+	RUN_TEST(System_interleavings_agree_with_fewer_switches);
+}
+
+void test_devices() {
+	RUN_TEST(Device_catches_up_when_touched);
+	RUN_TEST(Device_interrupts_are_taken_and_returned_from);
+	RUN_TEST(Interrupts_can_be_raised_from_another_thread);
+	RUN_TEST(SEI_masks_pending_interrupts);
+	RUN_TEST(CoDevice_waits_for_cycles_and_accesses);
+	RUN_TEST(FrameArena_recycles_coroutine_frames);
+	RUN_TEST(Via_timers_count_down_without_ticking);
+	RUN_TEST(Via_free_running_timer_interrupts_periodically);
+	RUN_TEST(Console_flushes_output_by_line);
+	RUN_TEST(Console_batches_output_and_reads_prefilled_input);
+	RUN_TEST(Console_rejects_an_empty_buffer);
+	RUN_TEST(BlockDevice_reads_sectors_after_a_latency);
+	RUN_TEST(BlockDevice_writes_sectors_through_the_mapping);
+	RUN_TEST(BlockDevice_ignores_registers_while_busy);
+	RUN_TEST(Mem_block_transfers_follow_page_modes);
+	RUN_TEST(Dma_copies_at_once_and_stalls_the_CPU);
+	RUN_TEST(Dma_feeds_a_device_register);
+	RUN_TEST(Framebuffer_streams_only_dirty_tiles);
+	RUN_TEST(Framebuffer_dumps_changed_frames_as_PPM);
+	RUN_TEST(Framebuffer_rejects_partial_tiles);
+	RUN_TEST(RingDevice_hands_guest_output_to_the_host_in_place);
+	RUN_TEST(RingDevice_lets_the_host_produce_for_the_guest);
+	RUN_TEST(RingDevice_rejects_bad_windows_and_guest_counters);
+	RUN_TEST(CycleCounter_times_guest_code);
+}
+
+void test_profiling() {
+	RUN_TEST(Profiler_counts_cycles_per_PC);
+	RUN_TEST(SymbolTable_reads_label_files);
+	RUN_TEST(CallGraph_attributes_cycles_to_callers);
+	RUN_TEST(CallGraph_unwinds_dropped_return_addresses);
+	RUN_TEST(CallGraph_follows_a_wrapping_stack_and_escapes_names);
+	RUN_TEST(Sampler_records_pc_and_callers);
+	RUN_TEST(Sampler_timer_thread_samples_a_running_cpu);
+	RUN_TEST(HostCounters_measure_a_run);
+	RUN_TEST(OpcodeCost_samples_one_instruction_in_n);
+	RUN_TEST(Statistics_counts_instruction_mix);
+	RUN_TEST(Statistics_can_be_read_while_running);
+	RUN_TEST(MemoryHeatmap_counts_accesses_per_page);
+	RUN_TEST(MemoryHeatmap_follows_indirect_addressing);
+}
+
 int main() {
 	test_load_instructions();
 	test_store_instructions();
@@ -141,6 +245,17 @@ int main() {
 	test_stack_instructions();
 	test_logic_instructions();
 	test_jump_instructions();
+	test_fleet();
+	test_lockstep();
+	test_scheduler();
+	test_shard();
+	test_memory();
+	test_decode();
+	test_async();
+	test_pacer();
+	test_system();
+	test_devices();
+	test_profiling();
 
 	return 0;
 }
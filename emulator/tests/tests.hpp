@@ -1,6 +1,37 @@
 #pragma once
 #include "cpu.hpp"
 #include "memory.hpp"
+#include "fleet.hpp"
+#include "lockstep.hpp"
+#include "scheduler.hpp"
+#include "shard.hpp"
+#include "mempool.hpp"
+#include "decode.hpp"
+#include "async.hpp"
+#include "pacer.hpp"
+#include "system.hpp"
+#include "device.hpp"
+#include "coroutine.hpp"
+#include "via.hpp"
+#include "console.hpp"
+#include "block.hpp"
+#include "dma.hpp"
+#include "framebuffer.hpp"
+#include "ring.hpp"
+#include "counter.hpp"
+#include "profiler.hpp"
+#include "callgraph.hpp"
+#include "sampler.hpp"
+#include "perf.hpp"
+#include "stats.hpp"
+#include "heatmap.hpp"
+
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <thread>
 
 #include <iostream>
 #include <sstream>
@@ -2148,3 +2179,2121 @@ CFG_TEST(RTS_works) {
 	EXPECT_EQ(memory[cpu.STACK + cpu.SP], 0xFF);
 	EXPECT_EQ(used_cycles, expected_used_cycles);
 }
+
+CFG_TEST(Fleet_runs_instances_up_to_their_cycle_limit) {
+	Fleet fleet(2, 30);
+
+	for (u32 i=0; i<4; i++) {
+		u32 id = fleet.add(nullptr, 300);
+		Fleet::Instance& instance = fleet.instance(id);
+		instance.cpu.reset(instance.memory);
+		// JMP $FFFC forever
+		instance.memory[0xFFFC] = CPU::INS_JMP_AB;
+		instance.memory[0xFFFD] = 0xFC;
+		instance.memory[0xFFFE] = 0xFF;
+	}
+
+	Fleet::Stats stats = fleet.run();
+
+	EXPECT_EQ(stats.finished, 4);
+	EXPECT_EQ(stats.cycles, 4 * 300);
+	EXPECT_EQ(stats.quanta, 4 * 10);
+	for (u32 i=0; i<fleet.size(); i++) {
+		EXPECT_TRUE(fleet.instance(i).done);
+		EXPECT_EQ(fleet.instance(i).cycles, 300);
+		EXPECT_EQ(fleet.instance(i).cpu.PC, 0xFFFC);
+	}
+}
+
+CFG_TEST(Fleet_stops_instances_on_their_stop_condition) {
+	Fleet fleet(2, 6);
+
+	for (u32 i=0; i<3; i++) {
+		u32 id = fleet.add([](const CPU&, const Mem& memory) { return memory[0x0200] != 0x00; });
+		Fleet::Instance& instance = fleet.instance(id);
+		instance.cpu.reset(instance.memory);
+		// JMP $4242 a few times, then LDA #i+1, STA $0200
+		instance.memory[0xFFFC] = CPU::INS_JMP_AB;
+		instance.memory[0xFFFD] = 0x42;
+		instance.memory[0xFFFE] = 0x42;
+		instance.memory[0x4242] = CPU::INS_LDA_IM;
+		instance.memory[0x4243] = (byte)(i + 1);
+		instance.memory[0x4244] = CPU::INS_STA_AB;
+		instance.memory[0x4245] = 0x00;
+		instance.memory[0x4246] = 0x02;
+		instance.memory[0x4247] = CPU::INS_JMP_AB;
+		instance.memory[0x4248] = 0x47;
+		instance.memory[0x4249] = 0x42;
+	}
+
+	Fleet::Stats stats = fleet.run();
+
+	EXPECT_EQ(stats.finished, 3);
+	for (u32 i=0; i<fleet.size(); i++) {
+		EXPECT_TRUE(fleet.instance(i).done);
+		EXPECT_EQ(fleet.instance(i).cpu.A, i + 1);
+		EXPECT_EQ(fleet.instance(i).memory[0x0200], i + 1);
+	}
+
+	// a second run has nothing left to do
+	stats = fleet.run();
+	EXPECT_EQ(stats.quanta, 0);
+}
+
+CFG_TEST(Fleet_rejects_an_empty_quantum) {
+	auto rejected = []( i32 quantum ) {
+		try {
+			Fleet fleet(1, quantum);
+		} catch (const std::invalid_argument&) {
+			return true;
+		}
+		return false;
+	};
+	EXPECT_TRUE(rejected(0));
+	EXPECT_TRUE(rejected(-100));
+	EXPECT_FALSE(rejected(1));
+}
+
+/** sweep program: A = ~input & 0x0F, stored to $10 and $0201, then loops */
+void load_sweep_program( Mem& memory, byte input ) {
+	memory[0x0200] = input;
+	memory[0xFFFC] = CPU::INS_JMP_AB;
+	memory[0xFFFD] = 0x00;
+	memory[0xFFFE] = 0x10;
+	memory[0x1000] = CPU::INS_LDA_AB;
+	memory[0x1001] = 0x00;
+	memory[0x1002] = 0x02;
+	memory[0x1003] = CPU::INS_EOR_IM;
+	memory[0x1004] = 0xFF;
+	memory[0x1005] = CPU::INS_AND_IM;
+	memory[0x1006] = 0x0F;
+	memory[0x1007] = CPU::INS_TAY;
+	memory[0x1008] = CPU::INS_STY_ZP;
+	memory[0x1009] = 0x10;
+	memory[0x100A] = CPU::INS_PHA;
+	memory[0x100B] = CPU::INS_PLA;
+	memory[0x100C] = CPU::INS_STA_AB;
+	memory[0x100D] = 0x01;
+	memory[0x100E] = 0x02;
+	memory[0x100F] = CPU::INS_JMP_AB;
+	memory[0x1010] = 0x00;
+	memory[0x1011] = 0x10;
+}
+
+CFG_TEST(Lockstep_matches_scalar_execution) {
+	constexpr u32 LANES = 8;
+	constexpr i32 CYCLES = 100;
+	Mem lane_memory[LANES];
+	Mem scalar_memory[LANES];
+	CPU scalar[LANES];
+	LockstepCPU lockstep;
+
+	for (u32 l=0; l<LANES; l++) {
+		scalar[l].reset(scalar_memory[l]);
+		load_sweep_program(scalar_memory[l], l * 3);
+		lane_memory[l] = scalar_memory[l];
+		lockstep.load(l, scalar[l], lane_memory[l]);
+		scalar[l].execute(scalar_memory[l], CYCLES);
+	}
+
+	lockstep.execute(CYCLES);
+
+	EXPECT_TRUE(lockstep.vector_steps > 0);
+	for (u32 l=0; l<LANES; l++) {
+		CPU cpu = lockstep.get(l);
+		EXPECT_EQ(cpu.PC, scalar[l].PC);
+		EXPECT_EQ(cpu.SP, scalar[l].SP);
+		EXPECT_EQ(cpu.A, scalar[l].A);
+		EXPECT_EQ(cpu.Y, scalar[l].Y);
+		EXPECT_EQ(cpu.flags, scalar[l].flags);
+		EXPECT_TRUE(cpu.clock == scalar[l].clock);
+		EXPECT_EQ(lane_memory[l][0x0010], (byte)(~(l * 3) & 0x0F));
+		EXPECT_EQ(lane_memory[l][0x0201], scalar_memory[l][0x0201]);
+		EXPECT_EQ(lockstep.used[l], (u32)(CYCLES - lockstep.budget[l]));
+	}
+}
+
+CFG_TEST(Lockstep_peels_diverging_lanes) {
+	constexpr u32 LANES = 4;
+	constexpr i32 CYCLES = 60;
+	Mem lane_memory[LANES];
+	Mem scalar_memory[LANES];
+	CPU scalar[LANES];
+	LockstepCPU lockstep;
+
+	for (u32 l=0; l<LANES; l++) {
+		scalar[l].reset(scalar_memory[l]);
+		load_sweep_program(scalar_memory[l], 0x80 + l);
+	}
+	// lane 2 jumps away after the load and comes back at the store
+	scalar_memory[2][0x1003] = CPU::INS_JMP_AB;
+	scalar_memory[2][0x1004] = 0x00;
+	scalar_memory[2][0x1005] = 0x20;
+	scalar_memory[2][0x2000] = CPU::INS_TAX;
+	scalar_memory[2][0x2001] = CPU::INS_JMP_AB;
+	scalar_memory[2][0x2002] = 0x0C;
+	scalar_memory[2][0x2003] = 0x10;
+
+	for (u32 l=0; l<LANES; l++) {
+		lane_memory[l] = scalar_memory[l];
+		lockstep.load(l, scalar[l], lane_memory[l]);
+		scalar[l].execute(scalar_memory[l], CYCLES);
+	}
+
+	lockstep.execute(CYCLES);
+
+	EXPECT_TRUE(lockstep.scalar_steps > 0);
+	for (u32 l=0; l<LANES; l++) {
+		CPU cpu = lockstep.get(l);
+		EXPECT_EQ(cpu.PC, scalar[l].PC);
+		EXPECT_EQ(cpu.A, scalar[l].A);
+		EXPECT_EQ(cpu.X, scalar[l].X);
+		EXPECT_EQ(cpu.Y, scalar[l].Y);
+		EXPECT_EQ(cpu.flags, scalar[l].flags);
+		EXPECT_EQ(lane_memory[l][0x0201], scalar_memory[l][0x0201]);
+	}
+	EXPECT_EQ(lane_memory[2][0x0201], 0x82);
+}
+
+/** a VIA timer interrupting every `period` + 2 cycles, the handler flips $0300 */
+void load_timer_program( CPU& cpu, Mem& memory, Via& via, byte period ) {
+	memory.initialize();
+	memory.attach(via, 0xC000, Via::SIZE);
+	cpu.reset(memory, 0x1000);
+	byte code[] = {
+		CPU::INS_LDA_IM, Via::ACR_T1_CONTINUOUS, CPU::INS_STA_AB, Via::ACR, 0xC0,
+		CPU::INS_LDA_IM, Via::IRQ_ANY | Via::IRQ_T1, CPU::INS_STA_AB, Via::IER, 0xC0,
+		CPU::INS_LDA_IM, period, CPU::INS_STA_AB, Via::T1C_L, 0xC0,
+		CPU::INS_LDA_IM, 0, CPU::INS_STA_AB, Via::T1C_H, 0xC0,
+		CPU::INS_CLI,
+		CPU::INS_LDA_IM, 0x01, CPU::INS_STA_AB, 0x01, 0x03, CPU::INS_JMP_AB, 0x15, 0x10,
+	};
+	for (u32 i=0; i<sizeof(code); i++) memory[0x1000 + i] = code[i];
+	byte handler[] = {
+		CPU::INS_LDA_AB, Via::T1C_L, 0xC0,
+		CPU::INS_LDA_AB, 0x00, 0x03, CPU::INS_EOR_IM, 0x01, CPU::INS_STA_AB, 0x00, 0x03,
+		CPU::INS_RTI,
+	};
+	for (u32 i=0; i<sizeof(handler); i++) memory[0x2000 + i] = handler[i];
+	memory[CPU::IRQ_VECTOR] = 0x00;
+	memory[CPU::IRQ_VECTOR + 1] = 0x20;
+}
+
+CFG_TEST(Lockstep_services_devices_like_scalar_execution) {
+	constexpr u32 LANES = 4;
+	constexpr i32 CYCLES = 2000;
+	Mem lane_memory[LANES];
+	Mem scalar_memory[LANES];
+	Via lane_via[LANES];
+	Via scalar_via[LANES];
+	CPU scalar[LANES];
+	LockstepCPU lockstep;
+
+	for (u32 l=0; l<LANES; l++) {
+		CPU cpu;
+		load_timer_program(cpu, lane_memory[l], lane_via[l], 60 + l * 7);
+		lockstep.load(l, cpu, lane_memory[l]);
+		load_timer_program(scalar[l], scalar_memory[l], scalar_via[l], 60 + l * 7);
+		scalar[l].execute(scalar_memory[l], CYCLES);
+	}
+
+	lockstep.execute(CYCLES);
+
+	EXPECT_TRUE(lockstep.vector_steps > 0);
+	for (u32 l=0; l<LANES; l++) {
+		CPU cpu = lockstep.get(l);
+		EXPECT_TRUE(scalar_via[l].t1_underflows > 10);
+		EXPECT_EQ(lane_via[l].t1_underflows, scalar_via[l].t1_underflows);
+		EXPECT_EQ(cpu.PC, scalar[l].PC);
+		EXPECT_EQ(cpu.SP, scalar[l].SP);
+		EXPECT_EQ(cpu.A, scalar[l].A);
+		EXPECT_EQ(cpu.flags, scalar[l].flags);
+		EXPECT_TRUE(cpu.clock == scalar[l].clock);
+		EXPECT_EQ(lane_memory[l][0x0300], scalar_memory[l][0x0300]);
+	}
+}
+
+/** JMP $FFFC forever */
+void load_idle_loop( CPU& cpu, Mem& memory ) {
+	cpu.reset(memory);
+	memory[0xFFFC] = CPU::INS_JMP_AB;
+	memory[0xFFFD] = 0xFC;
+	memory[0xFFFE] = 0xFF;
+}
+
+CFG_TEST(CPU_resume_carries_overspent_cycles) {
+	CPU cpu;
+	Mem memory;
+	load_idle_loop(cpu, memory);
+
+	i32 budget = 4;
+	u32 used = cpu.resume(memory, budget);
+	EXPECT_EQ(used, 6); // two JMPs of three cycles
+	EXPECT_EQ(budget, -2);
+
+	// the next slice pays back the two cycles first
+	budget += 4;
+	used = cpu.resume(memory, budget);
+	EXPECT_EQ(used, 3);
+	EXPECT_EQ(budget, -1);
+
+	budget = 0;
+	EXPECT_EQ(cpu.resume(memory, budget), 0);
+}
+
+CFG_TEST(Scheduler_shares_cycles_fairly) {
+	Scheduler scheduler(1, 100);
+	for (u32 i=0; i<3; i++) {
+		u32 id = scheduler.add(1000);
+		load_idle_loop(scheduler.task(id).cpu, scheduler.task(id).memory);
+	}
+
+	scheduler.run_for(5000000);
+
+	u64 min = ~0ull, max = 0;
+	for (u32 i=0; i<scheduler.size(); i++) {
+		u64 cycles = scheduler.task(i).cycles;
+		if (cycles < min) min = cycles;
+		if (cycles > max) max = cycles;
+	}
+	EXPECT_TRUE(min > 0);
+	EXPECT_TRUE(max - min <= 100 + 3);
+}
+
+CFG_TEST(Scheduler_does_not_run_parked_tasks) {
+	Scheduler scheduler(1, 100);
+	// the first task parks itself after every tick, as if waiting for I/O
+	u32 io = scheduler.add(300, 0, [&scheduler](Scheduler::Task& task) { scheduler.park(task.id); return true; });
+	u32 other = scheduler.add(300);
+	load_idle_loop(scheduler.task(io).cpu, scheduler.task(io).memory);
+	load_idle_loop(scheduler.task(other).cpu, scheduler.task(other).memory);
+
+	scheduler.run_for(2000000);
+	EXPECT_EQ(scheduler.task(io).ticks, 1);
+	EXPECT_TRUE(scheduler.task(io).state == Scheduler::PARKED);
+	EXPECT_TRUE(scheduler.task(other).ticks > 1);
+
+	scheduler.unpark(io);
+	scheduler.run_for(2000000);
+	EXPECT_EQ(scheduler.task(io).ticks, 2);
+}
+
+CFG_TEST(Scheduler_unpark_of_a_running_task_cancels_the_park) {
+	Scheduler scheduler(1, 100);
+	// parked and unparked while it runs, the task must never be queued twice nor stop
+	bool stayed_running = true;
+	u32 id = scheduler.add(300, 0, [&scheduler, &stayed_running](Scheduler::Task& task) {
+		scheduler.park(task.id);
+		stayed_running &= task.state == Scheduler::RUNNING;
+		scheduler.unpark(task.id);
+		return task.ticks < 5;
+	});
+	load_idle_loop(scheduler.task(id).cpu, scheduler.task(id).memory);
+
+	scheduler.run_for(100000000);
+	EXPECT_TRUE(scheduler.task(id).state == Scheduler::DONE);
+	EXPECT_EQ(scheduler.task(id).ticks, 5);
+	EXPECT_EQ(scheduler.task(id).cycles, 1500);
+	EXPECT_TRUE(stayed_running);
+}
+
+CFG_TEST(Scheduler_releases_ticks_once_per_period) {
+	constexpr u64 PERIOD = 2000000; // 2 ms
+	Scheduler scheduler(1, 100);
+	u64 start = Scheduler::now();
+	u32 id = scheduler.add(300, PERIOD, [](Scheduler::Task& task) { return task.ticks < 3; });
+	load_idle_loop(scheduler.task(id).cpu, scheduler.task(id).memory);
+
+	scheduler.run_for(100 * PERIOD);
+	u64 elapsed = Scheduler::now() - start;
+
+	EXPECT_TRUE(scheduler.task(id).state == Scheduler::DONE);
+	EXPECT_EQ(scheduler.task(id).ticks, 3);
+	// the third tick can not start before the beginning of the third period
+	EXPECT_TRUE(elapsed >= 2 * PERIOD);
+	EXPECT_TRUE(elapsed < 100 * PERIOD);
+	// 300 cycles per tick in JMPs of 3 cycles, nothing is overspent
+	EXPECT_EQ(scheduler.task(id).cycles, 900);
+}
+
+CFG_TEST(ShardPool_runs_jobs_in_worker_processes) {
+	ShardPool pool(2, 4);
+
+	// more jobs than slots, slots are given back as results come in
+	u32 submitted = 0, collected = 0;
+	bool seen[6] = {};
+	while (collected < 6) {
+		ShardPool::Job* job;
+		while (submitted < 6 && (job = pool.acquire())) {
+			job->cpu.reset(job->memory);
+			load_sweep_program(job->memory, submitted);
+			job->cycles = 50;
+			EXPECT_TRUE(pool.submit(job));
+			submitted++;
+		}
+
+		job = pool.collect();
+		EXPECT_TRUE(job->status == ShardPool::DONE);
+		EXPECT_TRUE(job->used >= 50);
+		byte input = job->memory[0x0200];
+		EXPECT_TRUE(input < 6);
+		EXPECT_EQ(job->cpu.Y, (byte)(~input & 0x0F));
+		EXPECT_EQ(job->memory[0x0010], (byte)(~input & 0x0F));
+		seen[input] = true;
+		pool.release(job);
+		collected++;
+	}
+
+	for (u32 i=0; i<6; i++) EXPECT_TRUE(seen[i]);
+	EXPECT_TRUE(pool.collect(false) == nullptr);
+}
+
+CFG_TEST(ShardPool_reports_jobs_of_crashed_workers) {
+	ShardPool pool(1, 2);
+
+	ShardPool::Job* job = pool.acquire();
+	load_idle_loop(job->cpu, job->memory);
+	job->cycles = 0x7FFFFFFF;
+	pool.submit(job);
+	while (job->status.load() != ShardPool::RUNNING) sched_yield();
+
+	kill(pool.worker_pid(job->worker), SIGKILL);
+	ShardPool::Job* failed = pool.collect();
+	EXPECT_TRUE(failed == job);
+	EXPECT_TRUE(failed->status == ShardPool::FAILED);
+	EXPECT_EQ(pool.respawned(), 1);
+	pool.release(failed);
+
+	// the replacement worker picks up new jobs
+	job = pool.acquire();
+	job->cpu.reset(job->memory);
+	load_sweep_program(job->memory, 0x0F);
+	job->cycles = 50;
+	pool.submit(job);
+	job = pool.collect();
+	EXPECT_TRUE(job->status == ShardPool::DONE);
+	EXPECT_EQ(job->memory[0x0010], 0x00);
+}
+
+CFG_TEST(SharedRing_recovers_claims_of_a_dead_process) {
+	alignas(64) byte buffer[1024];
+	SharedRing ring;
+	ring.create(buffer, 2);
+	SharedRing::Claim claim{SharedRing::NO_CLAIM};
+	u32 value = 0;
+
+	EXPECT_TRUE(ring.push(7));
+	EXPECT_TRUE(ring.push(8));
+	// a consumer dies after taking position 0 but before giving the cell back
+	EXPECT_TRUE(ring.pop(value, &claim));
+	EXPECT_EQ(value, 7);
+	EXPECT_EQ(SharedRing::claim_position(claim.load()), 0);
+	ring.cells[0].sequence.store(1);
+	EXPECT_FALSE(ring.push(9));
+	EXPECT_TRUE(ring.popped(0));
+	ring.release_pop(0);
+	EXPECT_TRUE(ring.push(9));
+
+	// a producer dies after taking position 3 but before publishing it
+	EXPECT_TRUE(ring.pop(value) && value == 8);
+	ring.header->tail.fetch_add(1);
+	EXPECT_TRUE(ring.pop(value) && value == 9);
+	EXPECT_FALSE(ring.pop(value, &claim));
+	EXPECT_TRUE(claim.load() == SharedRing::NO_CLAIM);
+	EXPECT_TRUE(ring.pushed(3));
+	ring.complete_push(3, 10);
+	EXPECT_TRUE(ring.pop(value) && value == 10);
+}
+
+CFG_TEST(ShardPool_only_ships_private_ram) {
+	ShardPool pool(1, 1);
+	static const byte rom[Mem::PAGE_SIZE] = {};
+	ShardPool::Job* job = pool.acquire();
+	job->memory.map_shared(0x2000, sizeof(rom), rom, Mem::ROM);
+
+	// the worker was forked before the ROM existed, the page would point nowhere
+	bool rejected = false;
+	try {
+		pool.submit(job);
+	} catch (const std::invalid_argument&) {
+		rejected = true;
+	}
+	EXPECT_TRUE(rejected);
+	EXPECT_TRUE(pool.collect(false) == nullptr);
+}
+
+CFG_TEST(Mem_copies_are_deep) {
+	Mem memory;
+	memory.initialize();
+	memory[0x1234] = 0x42;
+
+	Mem copy = memory;
+	copy[0x1234] = 0x24;
+	EXPECT_EQ(memory[0x1234], 0x42);
+	EXPECT_EQ(copy[0x1234], 0x24);
+
+	byte backing[Mem::MAX_MEM];
+	Mem borrowed(backing);
+	borrowed = memory;
+	EXPECT_TRUE(borrowed.memory == backing);
+	EXPECT_EQ(backing[0x1234], 0x42);
+}
+
+CFG_TEST(MemPool_hands_out_memory_from_2MB_arenas) {
+	MemPool pool;
+
+	std::vector<Mem*> memories;
+	for (u32 i=0; i<MemPool::MEM_PER_ARENA + 1; i++) memories.push_back(pool.acquire());
+	EXPECT_EQ(pool.arenas(), 2);
+
+	for (Mem* memory : memories) {
+		u64 arena = (u64)memory->memory & ~(MemPool::ARENA_SIZE - 1);
+		EXPECT_TRUE((u64)memory->memory + Mem::MAX_MEM <= arena + MemPool::ARENA_SIZE);
+	}
+
+	CPU cpu;
+	Mem& memory = *memories[5];
+	cpu.reset(memory);
+	memory[0xFFFC] = CPU::INS_LDA_IM;
+	memory[0xFFFD] = 0x03;
+	cpu.execute(memory, 2);
+	EXPECT_EQ(cpu.A, 0x03);
+
+	// recycling is LIFO and does not need another arena
+	pool.release(memories[5]);
+	EXPECT_TRUE(pool.acquire() == memories[5]);
+	for (Mem* m : memories) pool.release(m);
+	for (u32 i=0; i<MemPool::MEM_PER_ARENA * 2; i++) pool.acquire();
+	EXPECT_EQ(pool.arenas(), 2);
+}
+
+CFG_TEST(MemPool_recycles_slots_unmapped) {
+	MemPool pool;
+	static byte firmware[0x0100];
+	Via via;
+
+	Mem* memory = pool.acquire();
+	memory->map_shared(0xFF00, 0x100, firmware, Mem::ROM);
+	memory->attach(via, 0xC000, Via::SIZE);
+	memory->schedule(via, 100);
+	memory->raise_irq(1);
+	memory->steal(10);
+	pool.release(memory);
+
+	Mem* recycled = pool.acquire();
+	EXPECT_TRUE(recycled == memory);
+	EXPECT_EQ(recycled->private_pages(), Mem::PAGES);
+	EXPECT_TRUE(recycled->modes[0xC0] == Mem::RAM);
+	EXPECT_TRUE(recycled->devices[0xC0] == nullptr);
+	EXPECT_EQ(recycled->events.size(), 0);
+	EXPECT_FALSE(recycled->irq());
+	EXPECT_EQ(recycled->stall, 0);
+	EXPECT_TRUE(recycled->attention.load() == Mem::NEVER);
+	pool.release(recycled);
+}
+
+CFG_TEST(Mem_rejects_partial_shared_mappings) {
+	static byte buffer[0x0200];
+	Mem memory;
+	auto rejected = [&]( u16 address, u32 size ) {
+		try {
+			memory.map_shared(address, size, buffer);
+		} catch (const std::invalid_argument&) {
+			return true;
+		}
+		return false;
+	};
+	EXPECT_TRUE(rejected(0x2080, 0x100));
+	EXPECT_TRUE(rejected(0x2000, 0x180));
+	EXPECT_TRUE(rejected(0xFF00, 0x200));
+	EXPECT_FALSE(rejected(0xFF00, 0x100));
+	EXPECT_TRUE(memory.modes[0x20] == Mem::RAM);
+}
+
+CFG_TEST(Mem_rejects_misplaced_devices) {
+	Mem memory;
+	Via via;
+	auto rejected = [&]( u16 base, u32 size ) {
+		try {
+			memory.attach(via, base, size);
+		} catch (const std::invalid_argument&) {
+			return true;
+		}
+		return false;
+	};
+	EXPECT_TRUE(rejected(0xC008, Via::SIZE));
+	EXPECT_TRUE(rejected(0xFF00, 0x200));
+	EXPECT_TRUE(rejected(0xC000, 0));
+	EXPECT_TRUE(memory.modes[0xC0] == Mem::RAM);
+	EXPECT_FALSE(rejected(0xFF00, Via::SIZE));
+	EXPECT_TRUE(memory.modes[0xFF] == Mem::IO);
+}
+
+CFG_TEST(Mem_shares_ROM_pages_and_drops_writes) {
+	static byte firmware[0x0200];
+	for (u32 i=0; i<sizeof(firmware); i++) firmware[i] = 0xEA;
+	// at $FE00: LDA #$42, STA $FE10 (ROM), STA $0200 (RAM), JMP $FE0A
+	byte program[] = { CPU::INS_LDA_IM, 0x42, CPU::INS_STA_AB, 0x10, 0xFE, CPU::INS_STA_AB, 0x00, 0x02,
+		CPU::INS_JMP_AB, 0x08, 0xFE };
+	for (u32 i=0; i<sizeof(program); i++) firmware[i] = program[i];
+	firmware[0x01FC] = CPU::INS_JMP_AB;
+	firmware[0x01FD] = 0x00;
+	firmware[0x01FE] = 0xFE;
+
+	CPU cpus[2];
+	Mem memories[2];
+	for (u32 i=0; i<2; i++) {
+		cpus[i].reset(memories[i]);
+		memories[i].map_shared(0xFE00, sizeof(firmware), firmware, Mem::ROM);
+		cpus[i].execute(memories[i], 3 + 2 + 4 + 4);
+	}
+
+	for (u32 i=0; i<2; i++) {
+		EXPECT_EQ(cpus[i].PC, 0xFE08);
+		EXPECT_EQ(memories[i].read(0xFE10), 0xEA);
+		EXPECT_EQ(memories[i].read(0x0200), 0x42);
+		EXPECT_TRUE(memories[i].pages[0xFE] == firmware);
+		EXPECT_EQ(memories[i].private_pages(), Mem::PAGES - 2);
+	}
+	EXPECT_EQ(firmware[0x10], 0xEA);
+}
+
+CFG_TEST(Mem_copies_COW_pages_on_first_write) {
+	static byte table[Mem::PAGE_SIZE * 2];
+	for (u32 i=0; i<sizeof(table); i++) table[i] = (byte)i;
+
+	CPU cpu;
+	Mem memory;
+	cpu.reset(memory);
+	memory.map_shared(0x3000, sizeof(table), table, Mem::COW);
+
+	memory[0xFFFC] = CPU::INS_LDA_IM;
+	memory[0xFFFD] = 0x99;
+	memory[0xFFFE] = CPU::INS_STA_AB;
+	memory[0xFFFF] = 0x05;
+	memory[0x0000] = 0x31;
+	cpu.execute(memory, 2 + 4);
+
+	// only the written page got private backing
+	EXPECT_EQ(memory.read(0x3105), 0x99);
+	EXPECT_EQ(memory.read(0x3104), 0x04);
+	EXPECT_EQ(memory.read(0x3004), 0x04);
+	EXPECT_TRUE(memory.pages[0x30] == table);
+	EXPECT_TRUE(memory.modes[0x31] == Mem::RAM);
+	EXPECT_EQ(table[0x105], 0x05);
+
+	// copies keep sharing, a reset maps the original page back
+	Mem copy = memory;
+	EXPECT_TRUE(copy.pages[0x30] == table);
+	EXPECT_EQ(copy.read(0x3105), 0x99);
+	memory.initialize();
+	EXPECT_EQ(memory.read(0x3105), 0x05);
+	EXPECT_TRUE(memory.modes[0x31] == Mem::COW);
+}
+
+CFG_TEST(Mem_host_reads_do_not_copy_shared_pages) {
+	static byte rom[Mem::PAGE_SIZE];
+	for (u32 i=0; i<sizeof(rom); i++) rom[i] = 0xEA;
+	Mem memory;
+	memory.initialize();
+	memory.map_shared(0xFE00, sizeof(rom), rom, Mem::ROM);
+
+	byte value = memory[0xFE10];
+	EXPECT_EQ(value, 0xEA);
+	EXPECT_EQ(memory[0xFE11], 0xEA);
+	EXPECT_TRUE(memory.pages[0xFE] == rom);
+
+	// assignment gives the page private backing, the shared buffer stays intact
+	memory[0xFE10] = memory[0x0000];
+	EXPECT_EQ(memory[0xFE10], 0x00);
+	EXPECT_EQ(memory[0xFE11], 0xEA);
+	EXPECT_TRUE(memory.pages[0xFE] != rom);
+	EXPECT_EQ(rom[0x10], 0xEA);
+}
+
+CFG_TEST(op_info_matches_the_cycles_charged_by_execute) {
+	for (u32 opcode=0; opcode<256; opcode++) {
+		const OpInfo& info = op_info(opcode);
+		if (!info.name) continue;
+
+		CPU cpu;
+		Mem memory;
+		cpu.reset(memory, 0x1000);
+		memory[0x1000] = opcode;
+		memory[0x1001] = 0x10;
+		memory[0x1002] = 0x20;
+
+		u32 used = cpu.execute(memory, 1);
+		if (used != info.cycles) {
+			failures << "\t" << info.name << " (0x" << std::hex << opcode << ") takes "
+				<< std::dec << used << " cycles, not " << (u32)info.cycles << std::endl;
+			success = false;
+		}
+		EXPECT_TRUE(info.length >= 1 && info.length <= 3);
+	}
+	EXPECT_TRUE(op_info(0x00).name == nullptr);
+}
+
+CFG_TEST(SpscRing_keeps_order_and_capacity) {
+	SpscRing<u32, 4> ring;
+	u32 value = 0;
+	EXPECT_FALSE(ring.pop(value));
+	for (u32 i=0; i<4; i++) EXPECT_TRUE(ring.push(i));
+	EXPECT_FALSE(ring.push(4));
+	for (u32 i=0; i<4; i++) {
+		EXPECT_TRUE(ring.pop(value));
+		EXPECT_EQ(value, i);
+	}
+	EXPECT_TRUE(ring.empty());
+
+	// one producer thread, one consumer
+	static SpscRing<u32, 64> shared;
+	std::thread producer([]() { for (u32 i=0; i<10000; i++) while (!shared.push(i)) std::this_thread::yield(); });
+	u32 expected = 0;
+	while (expected < 10000) {
+		if (!shared.pop(value)) continue;
+		if (value != expected) success = false;
+		expected++;
+	}
+	producer.join();
+}
+
+CFG_TEST(AsyncMachine_answers_commands_in_order) {
+	AsyncMachine machine;
+	machine.cpu.reset(machine.memory);
+	load_sweep_program(machine.memory, 0x00);
+	machine.start(0);
+
+	Mem snapshot;
+	typedef AsyncMachine::Command Command;
+	EXPECT_TRUE(machine.send(Command{ Command::POKE, 1, 0, 0x0200, 0x05, nullptr }));
+	EXPECT_TRUE(machine.send(Command{ Command::RUN, 2, 3 + 4 + 2 + 2 + 1 + 3, 0, 0, nullptr }));
+	EXPECT_TRUE(machine.send(Command{ Command::PEEK, 3, 0, 0x0010, 0, nullptr }));
+	EXPECT_TRUE(machine.send(Command{ Command::SNAPSHOT, 4, 0, 0, 0, &snapshot }));
+
+	AsyncMachine::Event events[4];
+	u32 received = 0;
+	while (received < 4) if (machine.poll(events[received])) received++;
+	machine.stop();
+
+	for (u32 i=0; i<4; i++) EXPECT_EQ(events[i].tag, i + 1);
+	EXPECT_EQ(events[1].cycles, 15);
+	EXPECT_EQ(events[1].cpu.Y, 0x0A);
+	EXPECT_EQ(events[2].value, 0x0A);
+	EXPECT_EQ(events[3].total_cycles, 15);
+	EXPECT_EQ(snapshot.read(0x0200), 0x05);
+	EXPECT_EQ(snapshot.read(0x0010), 0x0A);
+	EXPECT_EQ(machine.dropped_events(), 0);
+}
+
+CFG_TEST(AsyncMachine_peeks_without_reading_devices) {
+	AsyncMachine machine;
+	Console console;
+	load_idle_loop(machine.cpu, machine.memory);
+	machine.memory.attach(console, 0xC100, Console::SIZE);
+	console.feed("ab");
+	machine.start();
+
+	typedef AsyncMachine::Command Command;
+	EXPECT_TRUE(machine.send(Command{ Command::PEEK, 1, 0, 0xC100 + Console::DATA, 0, nullptr }));
+	EXPECT_TRUE(machine.send(Command{ Command::PEEK, 2, 0, 0xC100 + Console::DATA, 0, nullptr }));
+
+	AsyncMachine::Event events[2];
+	u32 received = 0;
+	while (received < 2) if (machine.poll(events[received])) received++;
+	machine.stop();
+
+	EXPECT_EQ(events[0].value, 'a');
+	EXPECT_EQ(events[1].value, 'a');
+	EXPECT_EQ(machine.memory.read(0xC100 + Console::DATA), 'a');
+}
+
+CFG_TEST(AsyncMachine_stop_interrupts_a_long_run) {
+	AsyncMachine machine;
+	load_idle_loop(machine.cpu, machine.memory);
+	machine.start();
+
+	typedef AsyncMachine::Command Command;
+	machine.send(Command{ Command::RUN, 1, 0xFFFFFFF0, 0, 0, nullptr });
+	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	machine.stop();
+
+	AsyncMachine::Event event;
+	EXPECT_TRUE(machine.poll(event));
+	EXPECT_TRUE(event.cycles > 0);
+	EXPECT_TRUE(event.cycles < 0xFFFFFFF0);
+}
+
+CFG_TEST(Pacer_keeps_the_guest_clock_rate) {
+	CPU cpu;
+	Mem memory;
+	load_idle_loop(cpu, memory);
+
+	// 1 MHz, 2 ms frames: 2000 cycles per frame, not a multiple of JMP's 3 cycles
+	Pacer pacer(1000000, 2000000, 200000);
+	u64 start = Pacer::now();
+	Pacer::Stats stats = pacer.run(cpu, memory, 10);
+	u64 elapsed = Pacer::now() - start;
+
+	EXPECT_EQ(stats.frames, 10);
+	// the overshoot of one frame is paid back by the next, it never accumulates
+	EXPECT_TRUE(stats.cycles >= 20000 && stats.cycles < 20000 + 3);
+	EXPECT_TRUE(elapsed >= 10 * 2000000);
+	EXPECT_TRUE(stats.min_lateness >= 0);
+	EXPECT_TRUE(stats.max_lateness >= stats.min_lateness);
+	EXPECT_TRUE(stats.total_sleep > 0);
+	EXPECT_EQ(pacer.stats().frames, 10);
+}
+
+CFG_TEST(Pacer_stops_when_the_frame_handler_says_so) {
+	CPU cpu;
+	Mem memory;
+	load_idle_loop(cpu, memory);
+
+	Pacer pacer(1000000, 1000000);
+	Pacer::Stats stats = pacer.run(cpu, memory, 0, [](u64 frame) { return frame < 2; });
+	EXPECT_EQ(stats.frames, 3);
+	EXPECT_TRUE(stats.cycles >= 3000 && stats.cycles < 3000 + 3);
+}
+
+/**
+ * CPU 0 writes 1..16 to the shared $8000, padding with private work; CPU 1
+ * samples $8000 into its private log at $0300..
+ * */
+void load_shared_bus_programs( System& system ) {
+	System::Node& writer = system.node(0);
+	System::Node& reader = system.node(1);
+	writer.cpu.reset(writer.memory, 0x1000);
+	reader.cpu.reset(reader.memory, 0x1000);
+
+	u16 pc = 0x1000;
+	for (u32 i=1; i<=16; i++) {
+		writer.memory[pc++] = CPU::INS_LDA_IM;
+		writer.memory[pc++] = i;
+		for (u32 pad=0; pad<i % 3; pad++) {
+			writer.memory[pc++] = CPU::INS_STA_ZP;
+			writer.memory[pc++] = 0x10;
+		}
+		writer.memory[pc++] = CPU::INS_STA_AB;
+		writer.memory[pc++] = 0x00;
+		writer.memory[pc++] = 0x80;
+	}
+	// park on a JMP to itself
+	writer.memory[pc] = CPU::INS_JMP_AB;
+	writer.memory[pc + 1] = pc & 0xFF;
+	writer.memory[pc + 2] = pc >> 8;
+
+	pc = 0x1000;
+	for (u32 i=0; i<32; i++) {
+		reader.memory[pc++] = CPU::INS_LDA_AB;
+		reader.memory[pc++] = 0x00;
+		reader.memory[pc++] = 0x80;
+		reader.memory[pc++] = CPU::INS_STA_AB;
+		reader.memory[pc++] = i;
+		reader.memory[pc++] = 0x03;
+	}
+	reader.memory[pc] = CPU::INS_JMP_AB;
+	reader.memory[pc + 1] = pc & 0xFF;
+	reader.memory[pc + 2] = pc >> 8;
+}
+
+CFG_TEST(System_shares_RAM_between_CPUs) {
+	System system(2, 0x8000, 0x100);
+	system.node(0).memory.write(0x8042, 0x24);
+	EXPECT_EQ(system.node(1).memory.read(0x8042), 0x24);
+	EXPECT_EQ(system.shared()[0x42], 0x24);
+	system.node(1).memory[0x8043] = 0x42;
+	EXPECT_EQ(system.node(0).memory.read(0x8043), 0x42);
+	// a reset keeps the window mapped
+	system.node(0).cpu.reset(system.node(0).memory);
+	EXPECT_EQ(system.node(0).memory.read(0x8043), 0x42);
+}
+
+CFG_TEST(System_rejects_partial_shared_pages) {
+	auto rejected = []( u16 base, u32 size ) {
+		try {
+			System system(1, base, size);
+		} catch (const std::invalid_argument&) {
+			return true;
+		}
+		return false;
+	};
+	EXPECT_TRUE(rejected(0x8000, 0x180));
+	EXPECT_TRUE(rejected(0x8080, 0x100));
+	EXPECT_TRUE(rejected(0xFF00, 0x200));
+	EXPECT_FALSE(rejected(0xFF00, 0x100));
+}
+
+CFG_TEST(System_sees_the_stack_accesses_of_interrupts_and_RTI) {
+	// the stack page is the shared window
+	System system(2, 0x0100, 0x100);
+	System::Node& node = system.node(0);
+	node.cpu.reset(node.memory, 0x1000);
+	node.memory[0x1000] = CPU::INS_LDA_IM;
+	node.memory[0x1002] = CPU::INS_RTI;
+	EXPECT_FALSE(system.touches_shared(node));
+
+	// the next step takes the interrupt and pushes onto the shared page
+	node.memory.raise_irq(0);
+	EXPECT_TRUE(system.touches_shared(node));
+	node.cpu.I = 1;
+	EXPECT_FALSE(system.touches_shared(node));
+	node.memory.clear_irq(0);
+
+	node.cpu.PC = 0x1002;
+	node.cpu.SP = 0xFC;
+	EXPECT_TRUE(system.touches_shared(node));
+	EXPECT_EQ(node.cpu.execute(node.memory, 1), 6);
+	EXPECT_EQ(node.cpu.SP, 0xFF);
+}
+
+CFG_TEST(System_interleavings_agree_with_fewer_switches) {
+	System by_instruction(2, 0x8000, 0x100, System::INSTRUCTION);
+	System by_access(2, 0x8000, 0x100, System::SHARED_ACCESS);
+	load_shared_bus_programs(by_instruction);
+	load_shared_bus_programs(by_access);
+
+	by_instruction.run(250);
+	by_access.run(250);
+
+	for (u32 n=0; n<2; n++) {
+		EXPECT_EQ(by_instruction.node(n).time, by_access.node(n).time);
+		EXPECT_EQ(by_instruction.node(n).cpu.PC, by_access.node(n).cpu.PC);
+		EXPECT_EQ(by_instruction.node(n).cpu.A, by_access.node(n).cpu.A);
+	}
+	bool changed = false;
+	for (u32 i=0; i<32; i++) {
+		EXPECT_EQ(by_instruction.node(1).memory.read(0x0300 + i), by_access.node(1).memory.read(0x0300 + i));
+		changed |= by_access.node(1).memory.read(0x0300 + i) != by_access.node(1).memory.read(0x0300);
+	}
+	EXPECT_TRUE(changed); // the reader saw the writer make progress
+	EXPECT_TRUE(by_access.switches < by_instruction.switches);
+}
+
+/** counts catch ups and register accesses, and interrupts every `period` cycles once armed */
+struct TestDevice : Device {
+	u64 caught_up = 0;		// last cycle the device was brought up to
+	u64 last_write = 0;		// cycle of the last write
+	byte value = 0x00;
+	u32 period = 0;
+	u32 events = 0;
+	u32 acks = 0;
+
+	void catch_up( u64 cycle ) override { caught_up = cycle; }
+
+	/** reading register 0 acknowledges the interrupt */
+	byte read( u16 offset, u64 cycle ) override {
+		(void)cycle;
+		if (offset != 0) return value;
+		acks++;
+		bus->clear_irq(0);
+		return events;
+	}
+
+	/** writing register 1 arms the timer, `value` cycles from now */
+	void write( u16 offset, byte data, u64 cycle ) override {
+		value = data;
+		last_write = cycle;
+		if (offset == 1) {
+			period = data;
+			bus->schedule(*this, cycle + period);
+		}
+	}
+
+	byte peek( u16 offset ) const override { return offset == 0 ? events : value; }
+
+	void on_event( u64 cycle, u32 tag ) override {
+		(void)tag;
+		events++;
+		bus->raise_irq(0);
+		bus->schedule(*this, cycle + period);
+	}
+};
+
+CFG_TEST(Device_catches_up_when_touched) {
+	CPU cpu;
+	Mem memory;
+	TestDevice device;
+	memory.attach(device, 0xC000, 0x10);
+	cpu.reset(memory, 0x1000);
+
+	byte code[] = { CPU::INS_LDA_IM, 0x42, CPU::INS_TAX, CPU::INS_STA_AB, 0x02, 0xC0, CPU::INS_LDA_AB, 0x00, 0xC0 };
+	for (u32 i=0; i<sizeof(code); i++) memory[0x1000 + i] = code[i];
+
+	cpu.execute(memory, 3);
+	EXPECT_EQ(device.caught_up, 0);	// untouched so far
+	cpu.execute(memory, 1);
+	EXPECT_EQ(device.caught_up, 3);
+	EXPECT_EQ(device.last_write, 3);
+	EXPECT_EQ(device.value, 0x42);
+
+	// peeking has no side effect, reading register 0 acknowledges
+	EXPECT_EQ(memory.peek(0xC000), 0x00);
+	EXPECT_EQ(device.acks, 0);
+	cpu.execute(memory, 1);
+	EXPECT_EQ(device.acks, 1);
+	EXPECT_EQ(cpu.clock, 11);
+	EXPECT_EQ(device.caught_up, 7);
+
+	// a copy of the memory leaves the device behind
+	Mem copy = memory;
+	copy.write(0xC002, 0x24);
+	EXPECT_EQ(copy.read(0xC002), 0x24);
+	EXPECT_EQ(device.value, 0x42);
+}
+
+CFG_TEST(Device_interrupts_are_taken_and_returned_from) {
+	CPU cpu;
+	Mem memory;
+	TestDevice device;
+	memory.attach(device, 0xC000, 0x10);
+	cpu.reset(memory, 0x1000);
+
+	// arm the timer (25 cycles), enable interrupts and spin
+	byte code[] = { CPU::INS_LDA_IM, 25, CPU::INS_STA_AB, 0x01, 0xC0, CPU::INS_CLI, CPU::INS_JMP_AB, 0x06, 0x10 };
+	for (u32 i=0; i<sizeof(code); i++) memory[0x1000 + i] = code[i];
+	// the handler acknowledges and keeps the count
+	byte handler[] = { CPU::INS_LDA_AB, 0x00, 0xC0, CPU::INS_STA_ZP, 0x10, CPU::INS_RTI };
+	for (u32 i=0; i<sizeof(handler); i++) memory[0x2000 + i] = handler[i];
+	memory[CPU::IRQ_VECTOR] = 0x00;
+	memory[CPU::IRQ_VECTOR + 1] = 0x20;
+
+	cpu.execute(memory, 200);
+	while (cpu.PC >= 0x2000) cpu.execute(memory, 1);
+	EXPECT_EQ(device.events, 7); // at cycles 27, 52, ... 177
+	EXPECT_EQ(device.acks, device.events);
+	EXPECT_EQ(cpu.SP, 0xFF);
+	EXPECT_FALSE(cpu.I);
+	EXPECT_EQ(cpu.PC, 0x1006);
+	EXPECT_EQ(memory[0x10], device.events);
+}
+
+CFG_TEST(Interrupts_can_be_raised_from_another_thread) {
+	CPU cpu;
+	Mem memory;
+	cpu.reset(memory, 0x1000);
+	byte code[] = { CPU::INS_CLI, CPU::INS_JMP_AB, 0x01, 0x10 };
+	for (u32 i=0; i<sizeof(code); i++) memory[0x1000 + i] = code[i];
+	byte handler[] = { CPU::INS_JMP_AB, 0x00, 0x20 };
+	for (u32 i=0; i<sizeof(handler); i++) memory[0x2000 + i] = handler[i];
+	memory[CPU::IRQ_VECTOR] = 0x00;
+	memory[CPU::IRQ_VECTOR + 1] = 0x20;
+
+	std::thread raiser([&memory] {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		memory.raise_irq(3);
+	});
+	for (u32 i=0; i<1000000 && cpu.PC < 0x2000; i++) cpu.execute(memory, 300);
+	raiser.join();
+	EXPECT_TRUE(cpu.PC >= 0x2000);
+	EXPECT_TRUE(cpu.I);
+	memory.clear_irq(3);
+	EXPECT_FALSE(memory.irq());
+}
+
+CFG_TEST(SEI_masks_pending_interrupts) {
+	CPU cpu;
+	Mem memory;
+	TestDevice device;
+	memory.attach(device, 0xC000, 0x10);
+	cpu.reset(memory, 0x1000);
+
+	byte code[] = { CPU::INS_SEI, CPU::INS_JMP_AB, 0x01, 0x10 };
+	for (u32 i=0; i<sizeof(code); i++) memory[0x1000 + i] = code[i];
+	memory[CPU::IRQ_VECTOR] = 0x00;
+	memory[CPU::IRQ_VECTOR + 1] = 0x20;
+
+	cpu.execute(memory, 1);
+	memory.raise_irq(0);
+	cpu.execute(memory, 50);
+	EXPECT_TRUE(cpu.PC < 0x2000);
+	EXPECT_EQ(cpu.SP, 0xFF);
+
+	cpu.I = 0;
+	memory.wake(0);
+	cpu.execute(memory, 1);
+	EXPECT_EQ(cpu.PC, 0x2000);
+	EXPECT_EQ(cpu.SP, 0xFC);
+	EXPECT_TRUE(cpu.I);
+}
+
+/**
+ * writing a count to register 0 interrupts that many cycles later, reading it
+ * acknowledges and returns the interrupts so far. Register 1 echoes the last
+ * write, or 0xEE when nothing is written within 100 cycles.
+ * */
+struct CoTimer : CoDevice {
+	u32 fired = 0;
+	byte echo = 0x00;
+
+	explicit CoTimer( FrameArena& arena ) : CoDevice(arena) {}
+
+	byte peek( u16 offset ) const override { return offset == 0 ? fired : echo; }
+
+	DeviceTask body() {
+		while (true) {
+			Access access = co_await this->access(100);
+			if (access.type == Access::TIMEOUT) {
+				echo = 0xEE;
+			} else if (access.type == Access::WRITE && access.offset == 0) {
+				co_await cycles(access.value);
+				fired++;
+				bus->raise_irq(1);
+			} else if (access.type == Access::WRITE) {
+				echo = access.value;
+			} else if (access.offset == 0) {
+				bus->clear_irq(1);
+				respond(fired);
+			}
+		}
+	}
+};
+
+DeviceTask count_down( FrameArena& arena, u32& counter, Mem& bus, Device& device ) {
+	(void)arena;
+	(void)bus;
+	(void)device;
+	counter++;
+	co_return;
+}
+
+CFG_TEST(CoDevice_waits_for_cycles_and_accesses) {
+	FrameArena arena;
+	CPU cpu;
+	Mem memory;
+	CoTimer timer(arena);
+
+	// the waits are bus events, there is no bus yet
+	bool rejected = false;
+	try {
+		timer.start(timer.body());
+	} catch (const std::logic_error&) {
+		rejected = true;
+	}
+	EXPECT_TRUE(rejected);
+	EXPECT_EQ(arena.live(), 0);
+
+	memory.attach(timer, 0xC000, 0x10);
+	cpu.reset(memory, 0x1000);
+	timer.start(timer.body());
+	EXPECT_EQ(arena.live(), 1);
+
+	// start a 20 cycle countdown, echo 0x42 while it runs, then spin
+	byte code[] = { CPU::INS_LDA_IM, 20, CPU::INS_STA_AB, 0x00, 0xC0, CPU::INS_LDA_IM, 0x42,
+		CPU::INS_STA_AB, 0x01, 0xC0, CPU::INS_JMP_AB, 0x0A, 0x10 };
+	for (u32 i=0; i<sizeof(code); i++) memory[0x1000 + i] = code[i];
+
+	cpu.execute(memory, 20);
+	EXPECT_EQ(timer.fired, 0);
+	EXPECT_EQ(timer.echo, 0x00); // queued until the countdown is over
+	cpu.execute(memory, 6);
+	EXPECT_EQ(timer.fired, 1);	// due at cycle 22
+	EXPECT_EQ(timer.echo, 0x42);
+	EXPECT_TRUE(memory.irq());
+
+	// reads are answered by the body
+	EXPECT_EQ(memory.read(0xC000), 1);
+	EXPECT_FALSE(memory.irq());
+
+	// nothing happens for 100 cycles
+	cpu.execute(memory, 150);
+	EXPECT_EQ(timer.echo, 0xEE);
+}
+
+CFG_TEST(FrameArena_recycles_coroutine_frames) {
+	FrameArena arena;
+	Mem memory;
+	CoTimer timer(arena);
+	u32 counter = 0;
+	for (u32 i=0; i<1000; i++) {
+		DeviceTask task = count_down(arena, counter, memory, timer);
+		EXPECT_EQ(arena.live(), 1);
+		task.handle.resume();
+		EXPECT_TRUE(task.done());
+	}
+	EXPECT_EQ(counter, 1000);
+	EXPECT_EQ(arena.live(), 0);
+	EXPECT_EQ(arena.reserved(), FrameArena::CHUNK_SIZE);
+}
+
+CFG_TEST(Via_timers_count_down_without_ticking) {
+	Mem memory;
+	Via via;
+	memory.attach(via, 0xC000, Via::SIZE);
+
+	memory.now = 100;
+	memory.write(0xC000 + Via::T1C_L, 0x34);
+	memory.write(0xC000 + Via::T1C_H, 0x12);
+	memory.write(0xC000 + Via::T2C_L, 0x10);
+	memory.write(0xC000 + Via::T2C_H, 0x00);
+	EXPECT_EQ(memory.events.size(), 2);
+
+	memory.now = 100 + 0x34;
+	EXPECT_EQ(memory.read(0xC000 + Via::T1C_H), 0x12);
+	EXPECT_EQ(memory.read(0xC000 + Via::T1C_L), 0x00);
+	EXPECT_EQ(via.timer2(100 + 0x10), 0x00);
+	EXPECT_EQ(via.timer2(100 + 0x11), 0xFFFF);
+	EXPECT_EQ(via.timer2(100 + 0x20), 0xFFF0);
+
+	// timer 2 is one shot: one underflow, then the counter keeps going
+	memory.dispatch(100 + 0x11);
+	EXPECT_EQ(via.t2_underflows, 1);
+	EXPECT_EQ(memory.read(0xC000 + Via::IFR), Via::IRQ_T2);
+	EXPECT_FALSE(memory.irq()); // not enabled
+	memory.write(0xC000 + Via::IER, Via::IRQ_ANY | Via::IRQ_T2);
+	EXPECT_TRUE(memory.irq());
+	EXPECT_EQ(memory.read(0xC000 + Via::IFR), Via::IRQ_ANY | Via::IRQ_T2);
+	memory.now = 200;
+	memory.read(0xC000 + Via::T2C_L);
+	EXPECT_FALSE(memory.irq());
+	memory.dispatch(0x20000);
+	EXPECT_EQ(via.t2_underflows, 1);
+	EXPECT_EQ(via.t1_underflows, 1);
+	EXPECT_TRUE(memory.events.empty());
+
+	// the ports mix output latches and input pins
+	via.port_a_in = 0x0F;
+	memory.write(0xC000 + Via::DDRA, 0xF0);
+	memory.write(0xC000 + Via::ORA, 0xA5);
+	EXPECT_EQ(memory.read(0xC000 + Via::ORA), 0xAF);
+}
+
+CFG_TEST(Via_free_running_timer_interrupts_periodically) {
+	CPU cpu;
+	Mem memory;
+	Via via;
+	memory.attach(via, 0xC000, Via::SIZE);
+	cpu.reset(memory, 0x1000);
+
+	// T1 free running every 100 + 2 cycles, interrupts enabled
+	byte code[] = {
+		CPU::INS_LDA_IM, Via::ACR_T1_CONTINUOUS, CPU::INS_STA_AB, Via::ACR, 0xC0,
+		CPU::INS_LDA_IM, Via::IRQ_ANY | Via::IRQ_T1, CPU::INS_STA_AB, Via::IER, 0xC0,
+		CPU::INS_LDA_IM, 100, CPU::INS_STA_AB, Via::T1C_L, 0xC0,
+		CPU::INS_LDA_IM, 0, CPU::INS_STA_AB, Via::T1C_H, 0xC0,
+		CPU::INS_CLI, CPU::INS_JMP_AB, 0x15, 0x10,
+	};
+	for (u32 i=0; i<sizeof(code); i++) memory[0x1000 + i] = code[i];
+	// the handler acknowledges by reading T1C-L and keeps the count in $10
+	byte handler[] = { CPU::INS_LDA_AB, Via::T1C_L, 0xC0, CPU::INS_RTI };
+	for (u32 i=0; i<sizeof(handler); i++) memory[0x2000 + i] = handler[i];
+	memory[CPU::IRQ_VECTOR] = 0x00;
+	memory[CPU::IRQ_VECTOR + 1] = 0x20;
+
+	cpu.execute(memory, 10000);
+	while (cpu.PC >= 0x2000) cpu.execute(memory, 1);
+
+	// loaded at cycle 18, underflows at 119, 221, ...
+	u64 expected = (cpu.clock - 119) / 102 + 1;
+	EXPECT_EQ(via.t1_underflows, expected);
+	EXPECT_EQ(memory.events.size(), 1);
+	EXPECT_FALSE(memory.irq());
+	EXPECT_EQ(cpu.SP, 0xFF);
+	EXPECT_EQ(cpu.PC, 0x1015);
+}
+
+/** the guest writes `text` to the console at $C100, then spins */
+void load_print_program( CPU& cpu, Mem& memory, const char* text ) {
+	cpu.reset(memory, 0x1000);
+	u16 pc = 0x1000;
+	for (const char* c=text; *c; c++) {
+		memory[pc++] = CPU::INS_LDA_IM;
+		memory[pc++] = *c;
+		memory[pc++] = CPU::INS_STA_AB;
+		memory[pc++] = Console::DATA;
+		memory[pc++] = 0xC1;
+	}
+	memory[pc] = CPU::INS_JMP_AB;
+	memory[pc + 1] = pc & 0xFF;
+	memory[pc + 2] = pc >> 8;
+}
+
+std::string drain( int fd ) {
+	std::string text;
+	char chunk[256];
+	ssize_t size;
+	while ((size = ::read(fd, chunk, sizeof(chunk))) > 0) text.append(chunk, size);
+	return text;
+}
+
+CFG_TEST(Console_flushes_output_by_line) {
+	int pipe_fds[2];
+	EXPECT_EQ(pipe(pipe_fds), 0);
+	fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+
+	CPU cpu;
+	Mem memory;
+	Console console(pipe_fds[1]);
+	memory.attach(console, 0xC100, Console::SIZE);
+	load_print_program(cpu, memory, "hello\nworld\n!");
+
+	cpu.execute(memory, 200);
+	EXPECT_EQ(console.flushes, 2);
+	EXPECT_EQ(console.bytes_out, 13);
+	EXPECT_TRUE(drain(pipe_fds[0]) == "hello\nworld\n");
+	EXPECT_EQ(console.buffered(), 1);
+
+	// the rest goes out once the guest has been quiet for a while
+	cpu.execute(memory, 10000);
+	EXPECT_EQ(console.flushes, 3);
+	EXPECT_TRUE(drain(pipe_fds[0]) == "!");
+
+	close(pipe_fds[0]);
+	close(pipe_fds[1]);
+}
+
+CFG_TEST(Console_batches_output_and_reads_prefilled_input) {
+	int pipe_fds[2];
+	EXPECT_EQ(pipe(pipe_fds), 0);
+	fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+
+	CPU cpu;
+	Mem memory;
+	Console console(pipe_fds[1], 8, 1000, false);
+	memory.attach(console, 0xC100, Console::SIZE);
+	load_print_program(cpu, memory, "0123456789\nabc");
+
+	// full buffers go out as they fill up, newlines do not matter
+	cpu.execute(memory, 100);
+	EXPECT_EQ(console.flushes, 1);
+	EXPECT_TRUE(drain(pipe_fds[0]) == "01234567");
+	cpu.execute(memory, 1000);
+	EXPECT_EQ(console.flushes, 2);
+	EXPECT_TRUE(drain(pipe_fds[0]) == "89\nabc");
+
+	console.feed("ok");
+	EXPECT_EQ(memory.read(0xC100 + Console::STATUS), Console::OUTPUT_READY | Console::INPUT_READY);
+	EXPECT_EQ(memory.peek(0xC100 + Console::DATA), 'o');
+	EXPECT_EQ(memory.read(0xC100 + Console::DATA), 'o');
+	EXPECT_EQ(memory.read(0xC100 + Console::DATA), 'k');
+	EXPECT_EQ(memory.read(0xC100 + Console::STATUS), Console::OUTPUT_READY);
+	EXPECT_EQ(memory.read(0xC100 + Console::DATA), 0x00);
+
+	close(pipe_fds[0]);
+	close(pipe_fds[1]);
+}
+
+CFG_TEST(Console_rejects_an_empty_buffer) {
+	bool rejected = false;
+	try {
+		Console console(1, 0);
+	} catch (const std::invalid_argument&) {
+		rejected = true;
+	}
+	EXPECT_TRUE(rejected);
+}
+
+/** a temporary disk image where every byte of sector n is n */
+std::string make_disk_image( u32 sectors ) {
+	char path[] = "/tmp/m6502_disk_XXXXXX";
+	int fd = mkstemp(path);
+	for (u32 n=0; n<sectors; n++) {
+		byte sector[BlockDevice::SECTOR_SIZE];
+		for (u32 i=0; i<sizeof(sector); i++) sector[i] = n;
+		if (::write(fd, sector, sizeof(sector)) != sizeof(sector)) break;
+	}
+	close(fd);
+	return path;
+}
+
+void start_transfer( Mem& memory, u16 base, u16 sector, u16 address, byte count, byte command ) {
+	memory.write(base + BlockDevice::SECTOR_L, sector & 0xFF);
+	memory.write(base + BlockDevice::SECTOR_H, sector >> 8);
+	memory.write(base + BlockDevice::ADDRESS_L, address & 0xFF);
+	memory.write(base + BlockDevice::ADDRESS_H, address >> 8);
+	memory.write(base + BlockDevice::COUNT, count);
+	memory.write(base + BlockDevice::COMMAND, command);
+}
+
+CFG_TEST(BlockDevice_reads_sectors_after_a_latency) {
+	std::string path = make_disk_image(64);
+	{
+		Mem memory;
+		BlockDevice disk(path, false, 2, 1000, 64);
+		memory.attach(disk, 0xC200, BlockDevice::SIZE);
+		EXPECT_EQ(disk.sectors(), 64);
+		memory.write(0xC200 + BlockDevice::CONTROL, BlockDevice::IRQ_ENABLE);
+
+		memory.now = 10;
+		start_transfer(memory, 0xC200, 3, 0x0400, 2, BlockDevice::READ);
+		EXPECT_EQ(memory.read(0xC200 + BlockDevice::STATUS), BlockDevice::BUSY);
+		memory.dispatch(10 + 1000 + 2 * 64 - 1);
+		EXPECT_EQ(memory.read(0x0400), 0x00);
+		memory.dispatch(10 + 1000 + 2 * 64);
+		EXPECT_EQ(memory.read(0x0400), 3);
+		EXPECT_EQ(memory.read(0x05FF), 4);
+		EXPECT_EQ(memory.read(0x0600), 0x00);
+		EXPECT_TRUE(memory.irq());
+		EXPECT_EQ(memory.read(0xC200 + BlockDevice::STATUS), BlockDevice::DONE);
+		EXPECT_FALSE(memory.irq());
+
+		// the next sectors are read ahead, and a sequential read does not seek
+		memory.now = 2000;
+		start_transfer(memory, 0xC200, 5, 0x0400, 1, BlockDevice::READ);
+		EXPECT_EQ(memory.next_event(), 2000 + 64);
+		for (u32 wait=0; wait<1000 && disk.prefetched.load() < 1 + 16; wait++)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		EXPECT_TRUE(disk.prefetched.load() >= 1 + 16);
+		memory.dispatch(2000 + 64);
+		EXPECT_EQ(memory.read(0x0400), 5);
+
+		// writes need a writable image
+		start_transfer(memory, 0xC200, 0, 0x0400, 1, BlockDevice::WRITE);
+		EXPECT_EQ(memory.read(0xC200 + BlockDevice::STATUS), BlockDevice::ERROR | BlockDevice::DONE);
+	}
+	unlink(path.c_str());
+}
+
+CFG_TEST(BlockDevice_writes_sectors_through_the_mapping) {
+	std::string path = make_disk_image(4);
+	{
+		Mem memory;
+		BlockDevice disk(path, true);
+		memory.attach(disk, 0xC200, BlockDevice::SIZE);
+		for (u32 i=0; i<BlockDevice::SECTOR_SIZE; i++) memory[0x0300 + i] = 0xA0 + (i & 0x0F);
+		start_transfer(memory, 0xC200, 2, 0x0300, 1, BlockDevice::WRITE);
+		memory.dispatch(Mem::NEVER - 1);
+		EXPECT_EQ(disk.transfers, 1);
+	}
+	{
+		Mem memory;
+		BlockDevice disk(path);
+		memory.attach(disk, 0xC200, BlockDevice::SIZE);
+		start_transfer(memory, 0xC200, 1, 0x0480, 2, BlockDevice::READ);
+		memory.dispatch(Mem::NEVER - 1);
+		EXPECT_EQ(memory.read(0x0480), 1);
+		EXPECT_EQ(memory.read(0x0580), 0xA0);
+		EXPECT_EQ(memory.read(0x0581), 0xA1);
+	}
+	unlink(path.c_str());
+}
+
+CFG_TEST(BlockDevice_ignores_registers_while_busy) {
+	std::string path = make_disk_image(4);
+	{
+		Mem memory;
+		memory.initialize();
+		BlockDevice disk(path);
+		memory.attach(disk, 0xC200, BlockDevice::SIZE);
+		start_transfer(memory, 0xC200, 2, 0x0400, 1, BlockDevice::READ);
+
+		// a count past the image, and a write to a read-only image
+		memory.write(0xC200 + BlockDevice::COUNT, 0xFF);
+		memory.write(0xC200 + BlockDevice::SECTOR_L, 0x03);
+		memory.write(0xC200 + BlockDevice::ADDRESS_H, 0x08);
+		memory.write(0xC200 + BlockDevice::COMMAND, BlockDevice::WRITE);
+		EXPECT_EQ(memory.peek(0xC200 + BlockDevice::COUNT), 1);
+		EXPECT_EQ(memory.read(0xC200 + BlockDevice::STATUS), BlockDevice::BUSY);
+
+		memory.dispatch(Mem::NEVER - 1);
+		EXPECT_EQ(disk.transfers, 1);
+		EXPECT_EQ(memory.read(0xC200 + BlockDevice::STATUS), BlockDevice::DONE);
+		EXPECT_EQ(memory.read(0x0400), 2);
+		EXPECT_EQ(memory.read(0x04FF), 2);
+		EXPECT_EQ(memory.read(0x0500), 0x00);
+		EXPECT_EQ(memory.read(0x0800), 0x00);
+	}
+	unlink(path.c_str());
+}
+
+CFG_TEST(Mem_block_transfers_follow_page_modes) {
+	std::vector<byte> rom(0x200, 0x11);
+	Mem memory;
+	memory.initialize();
+	memory.map_shared(0x2000, 0x100, rom.data(), Mem::ROM);
+	memory.map_shared(0x2100, 0x100, rom.data() + 0x100, Mem::COW);
+
+	std::vector<byte> data(0x300, 0x22);
+	memory.write_block(0x1F80, data.data(), data.size());
+	EXPECT_EQ(memory.read(0x1F80), 0x22);
+	EXPECT_EQ(memory.read(0x2000), 0x11);	// ROM
+	EXPECT_EQ(memory.read(0x2100), 0x22);	// copied on write
+	EXPECT_EQ(rom[0x100], 0x11);
+	EXPECT_EQ(memory.read(0x227F), 0x22);
+	EXPECT_EQ(memory.read(0x2280), 0x00);
+
+	// wraps around the address space
+	memory.write_block(0xFFFF, data.data(), 2);
+	EXPECT_EQ(memory.read(0x0000), 0x22);
+
+	std::vector<byte> out(0x300);
+	memory.read_block(0x1F80, out.data(), out.size());
+	EXPECT_EQ(out[0x7F], 0x22);
+	EXPECT_EQ(out[0x80], 0x11);
+	EXPECT_EQ(out[0x180], 0x22);
+}
+
+CFG_TEST(Dma_copies_at_once_and_stalls_the_CPU) {
+	CPU cpu;
+	Mem memory;
+	Dma dma(1);
+	memory.attach(dma, 0xC300, Dma::SIZE);
+	cpu.reset(memory, 0x1000);
+	for (u32 i=0; i<0x100; i++) memory[0x0300 + i] = i;
+
+	// $0300 -> $0600, 256 bytes, with an interrupt when done
+	byte registers[][2] = {
+		{ Dma::SOURCE_L, 0x00 }, { Dma::SOURCE_H, 0x03 },
+		{ Dma::DESTINATION_L, 0x00 }, { Dma::DESTINATION_H, 0x06 },
+		{ Dma::LENGTH_L, 0x00 }, { Dma::LENGTH_H, 0x01 },
+		{ Dma::CONTROL, Dma::START | Dma::IRQ_ENABLE },
+	};
+	u16 pc = 0x1000;
+	for (auto& reg : registers) {
+		memory[pc] = CPU::INS_LDA_IM;
+		memory[pc + 1] = reg[1];
+		memory[pc + 2] = CPU::INS_STA_AB;
+		memory[pc + 3] = reg[0];
+		memory[pc + 4] = 0xC3;
+		pc += 5;
+	}
+	memory[pc] = CPU::INS_JMP_AB;
+	memory[pc + 1] = pc & 0xFF;
+	memory[pc + 2] = pc >> 8;
+	byte handler[] = { CPU::INS_LDA_AB, Dma::STATUS, 0xC3, CPU::INS_STA_ZP, 0x10, CPU::INS_RTI };
+	for (u32 i=0; i<sizeof(handler); i++) memory[0x2000 + i] = handler[i];
+	memory[CPU::IRQ_VECTOR] = 0x00;
+	memory[CPU::IRQ_VECTOR + 1] = 0x20;
+
+	for (u32 i=0; i<14; i++) cpu.execute(memory, 1);
+	EXPECT_EQ(memory.read(0x06FF), 0xFF);
+	EXPECT_EQ(memory.read(0x0680), 0x80);
+	EXPECT_EQ(dma.peek(Dma::STATUS), Dma::BUSY);
+
+	// the next instruction boundary pays for the bus cycles, then the interrupt comes
+	EXPECT_EQ(cpu.execute(memory, 1), 512);
+	cpu.execute(memory, 1);
+	EXPECT_EQ(cpu.PC, 0x2000);
+	while (cpu.PC >= 0x2000) cpu.execute(memory, 1);
+	EXPECT_EQ(memory[0x10], Dma::DONE);
+	EXPECT_EQ(cpu.PC, pc);
+	EXPECT_FALSE(memory.irq());
+	EXPECT_EQ(dma.transfers, 1);
+}
+
+CFG_TEST(Dma_feeds_a_device_register) {
+	int pipe_fds[2];
+	EXPECT_EQ(pipe(pipe_fds), 0);
+	fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+	{
+		Mem memory;
+		Dma dma;
+		Console console(pipe_fds[1], 64, 1000, false);
+		memory.attach(dma, 0xC300, Dma::SIZE);
+		memory.attach(console, 0xC100, Console::SIZE);
+		const char* text = "from memory";
+		for (u32 i=0; text[i]; i++) memory[0x0400 + i] = text[i];
+
+		memory.write(0xC300 + Dma::SOURCE_H, 0x04);
+		memory.write(0xC300 + Dma::DESTINATION_L, Console::DATA);
+		memory.write(0xC300 + Dma::DESTINATION_H, 0xC1);
+		memory.write(0xC300 + Dma::LENGTH_L, 11);
+		memory.write(0xC300 + Dma::CONTROL, Dma::START | Dma::DESTINATION_FIXED);
+		EXPECT_EQ(console.bytes_out, 11);
+		EXPECT_EQ(memory.stall, 22);
+	}
+	EXPECT_TRUE(drain(pipe_fds[0]) == "from memory");
+	close(pipe_fds[0]);
+	close(pipe_fds[1]);
+}
+
+CFG_TEST(Framebuffer_streams_only_dirty_tiles) {
+	int pipe_fds[2];
+	EXPECT_EQ(pipe(pipe_fds), 0);
+	fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+
+	Mem memory;
+	Framebuffer screen(64, 32);
+	memory.attach(screen, 0x4000, 64 * 32);
+	screen.stream_to(pipe_fds[1]);
+
+	// two neighbouring tiles on the first tile row, one on the last
+	memory.write(0x4000 + 3, 0xE0);
+	memory.write(0x4000 + 8 + 64, 0x1C);
+	memory.write(0x4000 + 31 * 64 + 63, 0x03);
+	EXPECT_EQ(memory.read(0x4000 + 3), 0xE0);
+	EXPECT_EQ(screen.end_frame(1), 2);
+	// rewriting the same values changes nothing
+	memory.write(0x4000 + 3, 0xE0);
+	EXPECT_EQ(screen.end_frame(2), 0);
+	screen.flush();
+
+	std::string stream = drain(pipe_fds[0]);
+	u32 rect_size = sizeof(Framebuffer::RectHeader);
+	EXPECT_EQ(stream.size(), rect_size + 16 * 8 + rect_size + 8 * 8);
+	Framebuffer::RectHeader header;
+	std::memcpy(&header, stream.data(), sizeof(header));
+	EXPECT_EQ(header.frame, 1);
+	EXPECT_EQ(header.rect.x, 0);
+	EXPECT_EQ(header.rect.w, 16);
+	EXPECT_EQ(header.rect.h, 8);
+	EXPECT_EQ((byte)stream[rect_size + 3], 0xE0);
+	EXPECT_EQ((byte)stream[rect_size + 16 + 8], 0x1C);
+	std::memcpy(&header, stream.data() + rect_size + 16 * 8, sizeof(header));
+	EXPECT_EQ(header.rect.x, 56);
+	EXPECT_EQ(header.rect.y, 24);
+
+	close(pipe_fds[0]);
+	close(pipe_fds[1]);
+}
+
+CFG_TEST(Framebuffer_dumps_changed_frames_as_PPM) {
+	char prefix[] = "/tmp/m6502_fb_XXXXXX";
+	EXPECT_TRUE(mkdtemp(prefix) != nullptr);
+	std::string base = std::string(prefix) + "/frame_";
+
+	Mem memory;
+	Framebuffer screen(16, 16);
+	memory.attach(screen, 0x4000, 16 * 16);
+	screen.dump_ppm(base);
+	memory.write(0x4000 + 17, 0xFF);
+	screen.end_frame(7);
+	screen.end_frame(8);
+	screen.flush();
+
+	FILE* file = std::fopen((base + "000007.ppm").c_str(), "rb");
+	EXPECT_TRUE(file != nullptr);
+	if (file) {
+		char magic[3] = {};
+		u32 width = 0, height = 0, max = 0;
+		EXPECT_EQ(std::fscanf(file, "%2s %u %u %u", magic, &width, &height, &max), 4);
+		std::fgetc(file);
+		byte pixels[16 * 16 * 3];
+		EXPECT_EQ(std::fread(pixels, 1, sizeof(pixels), file), sizeof(pixels));
+		EXPECT_TRUE(std::string(magic) == "P6");
+		EXPECT_EQ(width, 16);
+		EXPECT_EQ(pixels[17 * 3], 0xFF);
+		EXPECT_EQ(pixels[16 * 3], 0x00);
+		std::fclose(file);
+		unlink((base + "000007.ppm").c_str());
+	}
+	EXPECT_TRUE(access((base + "000008.ppm").c_str(), F_OK) != 0);
+	rmdir(prefix);
+}
+
+CFG_TEST(Framebuffer_rejects_partial_tiles) {
+	auto rejected = []( u16 width, u16 height ) {
+		try {
+			Framebuffer screen(width, height);
+		} catch (const std::invalid_argument&) {
+			return true;
+		}
+		return false;
+	};
+	EXPECT_TRUE(rejected(60, 32));
+	EXPECT_TRUE(rejected(64, 30));
+	EXPECT_TRUE(rejected(0, 32));
+	EXPECT_FALSE(rejected(64, 32));
+}
+
+CFG_TEST(RingDevice_hands_guest_output_to_the_host_in_place) {
+	CPU cpu;
+	Mem memory;
+	RingDevice ring(RingDevice::TO_HOST, 0x0800, 0x100);
+	memory.attach(ring, 0xC400, RingDevice::SIZE);
+	cpu.reset(memory, 0x1000);
+
+	std::string received;
+	ring.on_doorbell = [&received]( RingDevice& ring ) {
+		RingDevice::Spans data = ring.readable();
+		received.append((const char*)data.first.data(), data.first.size());
+		received.append((const char*)data.second.data(), data.second.size());
+		ring.consume(data.size());
+	};
+
+	// the guest stores "hey" in the ring, moves the head and rings
+	byte code[] = {
+		CPU::INS_LDA_IM, 'h', CPU::INS_STA_AB, 0x00, 0x08,
+		CPU::INS_LDA_IM, 'e', CPU::INS_STA_AB, 0x01, 0x08,
+		CPU::INS_LDA_IM, 'y', CPU::INS_STA_AB, 0x02, 0x08,
+		CPU::INS_LDA_IM, 3, CPU::INS_STA_AB, RingDevice::HEAD_L, 0xC4,
+		CPU::INS_LDA_IM, 0, CPU::INS_STA_AB, RingDevice::HEAD_H, 0xC4,
+		CPU::INS_STA_AB, RingDevice::DOORBELL, 0xC4,
+		CPU::INS_LDA_AB, RingDevice::TAIL_L, 0xC4,
+	};
+	for (u32 i=0; i<sizeof(code); i++) memory[0x1000 + i] = code[i];
+	for (u32 i=0; i<12; i++) cpu.execute(memory, 1);
+
+	EXPECT_TRUE(received == "hey");
+	EXPECT_EQ(ring.doorbells, 1);
+	EXPECT_EQ(cpu.A, 3); // the guest sees the space given back
+	EXPECT_EQ(memory.read(0xC400 + RingDevice::PAGES), 1);
+	EXPECT_EQ(memory.read(0xC400 + RingDevice::BASE_H), 0x08);
+}
+
+CFG_TEST(RingDevice_lets_the_host_produce_for_the_guest) {
+	Mem memory;
+	RingDevice ring(RingDevice::TO_GUEST, 0x0800, 0x100, 3);
+	memory.attach(ring, 0xC400, RingDevice::SIZE);
+	memory.write(0xC400 + RingDevice::CONTROL, RingDevice::IRQ_ENABLE);
+
+	// the guest has consumed 250 bytes, the next 10 wrap around
+	memory.write(0xC400 + RingDevice::TAIL_L, 250);
+	memory.write(0xC400 + RingDevice::TAIL_H, 0);
+	ring.produce(250);
+	RingDevice::Spans space = ring.writable();
+	EXPECT_EQ(space.size(), 0x100);
+	EXPECT_EQ(space.first.size(), 6);
+	EXPECT_TRUE(space.first.data() == memory.memory + 0x08FA);
+	for (u32 i=0; i<10; i++) (i < 6 ? space.first[i] : space.second[i - 6]) = 0x30 + i;
+	ring.produce(10);
+	ring.ring_guest();
+
+	EXPECT_TRUE(memory.irq());
+	EXPECT_EQ(memory.read(0xC400 + RingDevice::HEAD_L), 4);
+	EXPECT_EQ(memory.read(0xC400 + RingDevice::HEAD_H), 1);
+	EXPECT_EQ(memory.read(0x08FF), 0x35);
+	EXPECT_EQ(memory.read(0x0800), 0x36);
+	EXPECT_EQ(memory.read(0xC400 + RingDevice::STATUS), RingDevice::RANG);
+	EXPECT_FALSE(memory.irq());
+	// the host's counter is not the guest's to move
+	memory.write(0xC400 + RingDevice::HEAD_L, 0);
+	memory.write(0xC400 + RingDevice::HEAD_H, 0);
+	EXPECT_EQ(ring.head(), 260);
+}
+
+CFG_TEST(RingDevice_rejects_bad_windows_and_guest_counters) {
+	auto rejected = []( u16 base, u32 capacity ) {
+		try {
+			RingDevice ring(RingDevice::TO_HOST, base, capacity);
+		} catch (const std::invalid_argument&) {
+			return true;
+		}
+		return false;
+	};
+	EXPECT_TRUE(rejected(0x0800, 0x180));
+	EXPECT_TRUE(rejected(0x0800, 0));
+	EXPECT_TRUE(rejected(0x0880, 0x100));
+	EXPECT_TRUE(rejected(0xFF00, 0x200));
+	EXPECT_FALSE(rejected(0x0800, 0x40));
+
+	// a head far past the tail is a full ring, not a span past the payload
+	Mem memory;
+	RingDevice ring(RingDevice::TO_HOST, 0x0800, 0x100);
+	memory.attach(ring, 0xC400, RingDevice::SIZE);
+	memory.write(0xC400 + RingDevice::HEAD_L, 0x00);
+	memory.write(0xC400 + RingDevice::HEAD_H, 0x80);
+	EXPECT_EQ(ring.readable().size(), 0x100);
+	EXPECT_TRUE(ring.readable().first.data() == memory.memory + 0x0800);
+
+	// spans into the backing of a ROM page would not be what the guest sees
+	std::vector<byte> rom(0x100, 0x11);
+	memory.map_shared(0x0800, 0x100, rom.data(), Mem::ROM);
+	bool thrown = false;
+	try {
+		ring.readable();
+	} catch (const std::logic_error&) {
+		thrown = true;
+	}
+	EXPECT_TRUE(thrown);
+}
+
+CFG_TEST(CycleCounter_times_guest_code) {
+	CPU cpu;
+	Mem memory;
+	CycleCounter counter;
+	memory.attach(counter, 0xC500, CycleCounter::SIZE);
+	cpu.reset(memory, 0x1000);
+
+	// time a few instructions in slot 2, twice, then read the low half of the counter
+	byte code[] = {
+		CPU::INS_LDA_IM, 2, CPU::INS_STA_AB, CycleCounter::START, 0xC5,
+		CPU::INS_LDX_IM, 0x01, CPU::INS_LDY_IM, 0x02, CPU::INS_TAX,
+		CPU::INS_LDA_IM, 2, CPU::INS_STA_AB, CycleCounter::STOP, 0xC5,
+		CPU::INS_LDX_AB, CycleCounter::COUNTER_0, 0xC5,
+		CPU::INS_LDY_AB, CycleCounter::COUNTER_1, 0xC5,
+	};
+	for (u32 i=0; i<sizeof(code); i++) memory[0x1000 + i] = code[i];
+
+	for (u32 i=0; i<7; i++) cpu.execute(memory, 1);
+	cpu.PC = 0x1000;
+	for (u32 i=0; i<9; i++) cpu.execute(memory, 1);
+
+	const CycleCounter::Slot& slot = counter.slot(2);
+	EXPECT_EQ(slot.count, 2);
+	EXPECT_EQ(slot.min, 11);	// STA 4, LDX 2, LDY 2, TAX 1, LDA 2
+	EXPECT_EQ(slot.max, 11);
+	EXPECT_EQ(slot.buckets[4], 2);
+	EXPECT_EQ(slot.percentile(0.5), 11);
+	EXPECT_EQ(counter.slot(0).count, 0);
+
+	u64 read_at = cpu.clock - 4 - 4;
+	EXPECT_EQ(cpu.X, read_at & 0xFF);
+	EXPECT_EQ(cpu.Y, (read_at >> 8) & 0xFF);
+
+	memory.write(0xC500 + CycleCounter::STOP, 5);
+	EXPECT_EQ(counter.unmatched_stops, 1);
+	std::stringstream report;
+	counter.report(report);
+	EXPECT_TRUE(report.str().find("slot  2  count 2  min 11") == 0);
+}
+
+CFG_TEST(Profiler_counts_cycles_per_PC) {
+	CPU cpu;
+	Mem memory;
+	Profiler profiler;
+	cpu.reset(memory, 0x1000);
+	// start: LDX #0, loop: LDA #5 / STA $20 / LDA $0300 / TAX / JMP loop
+	byte code[] = {
+		CPU::INS_LDX_IM, 0x00,
+		CPU::INS_LDA_IM, 0x05, CPU::INS_STA_ZP, 0x20, CPU::INS_LDA_AB, 0x00, 0x03, CPU::INS_TAX,
+		CPU::INS_JMP_AB, 0x02, 0x10,
+	};
+	for (u32 i=0; i<sizeof(code); i++) memory[0x1000 + i] = code[i];
+	profiler.symbols.add(0x1000, "start");
+	profiler.symbols.add(0x1002, "loop");
+
+	u32 used = cpu.execute(memory, 2 + 13 * 100, profiler);
+	EXPECT_EQ(used, 2 + 13 * 100);
+	EXPECT_EQ(profiler.at(0x1000).instructions, 1);
+	EXPECT_EQ(profiler.at(0x1002).instructions, 100);
+	EXPECT_EQ(profiler.at(0x1004).cycles, 300);
+	EXPECT_EQ(profiler.at(0x1006).cycles, 400);
+	EXPECT_EQ(profiler.at(0x1003).instructions, 0);
+	EXPECT_EQ(profiler.total_cycles(), used);
+	std::vector<u16> hottest = profiler.hottest(2);
+	EXPECT_EQ(hottest.size(), 2);
+	EXPECT_EQ(hottest[0], 0x1006);
+	EXPECT_EQ(hottest[1], 0x1004);
+
+	std::stringstream folded;
+	profiler.write_folded(folded);
+	EXPECT_TRUE(folded.str() == "start;start 2\nloop;loop 200\nloop;loop+0x2 300\nloop;loop+0x4 400\n"
+		"loop;loop+0x7 100\nloop;loop+0x8 300\n");
+
+	std::stringstream pprof;
+	profiler.write_pprof(pprof);
+	EXPECT_TRUE(pprof.str().size() > 100);
+	EXPECT_TRUE(pprof.str().find("loop") != std::string::npos);
+}
+
+CFG_TEST(SymbolTable_reads_label_files) {
+	char path[] = "/tmp/m6502_labels_XXXXXX";
+	int fd = mkstemp(path);
+	const char* text = "al 001000 .reset\nal C:2000 .irq\nputs = $3000\n4000 main\n\n";
+	EXPECT_TRUE(::write(fd, text, std::strlen(text)) > 0);
+	close(fd);
+
+	SymbolTable symbols;
+	EXPECT_TRUE(symbols.load(path));
+	unlink(path);
+	EXPECT_EQ(symbols.size(), 4);
+	EXPECT_TRUE(symbols.describe(0x1000) == "reset");
+	EXPECT_TRUE(symbols.describe(0x2003) == "irq+0x3");
+	EXPECT_TRUE(symbols.describe(0x30FF) == "puts+0xFF");
+	EXPECT_TRUE(symbols.describe(0x4000) == "main");
+	EXPECT_TRUE(symbols.describe(0x0FFF) == "$0FFF");
+	EXPECT_FALSE(symbols.load("/nonexistent/labels"));
+}
+
+CFG_TEST(CallGraph_attributes_cycles_to_callers) {
+	CPU cpu;
+	Mem memory;
+	CallGraph calls;
+	cpu.reset(memory, 0x1000);
+	// RTS resumes on the last byte of the JSR, the routines sit at $A9xx so it reads as LDA #
+	byte main[] = { CPU::INS_JSR_AB, 0x00, 0xA9, 0x00 };
+	byte outer[] = {
+		CPU::INS_JSR_AB, 0x20, 0xA9, 0x00,
+		CPU::INS_JSR_AB, 0x20, 0xA9, 0x00,
+		CPU::INS_RTS,
+	};
+	byte inner[] = { CPU::INS_LDA_IM, 0x01, CPU::INS_RTS };
+	for (u32 i=0; i<sizeof(main); i++) memory[0x1000 + i] = main[i];
+	for (u32 i=0; i<sizeof(outer); i++) memory[0xA900 + i] = outer[i];
+	for (u32 i=0; i<sizeof(inner); i++) memory[0xA920 + i] = inner[i];
+	calls.symbols.add(0xA900, "outer");
+	calls.symbols.add(0xA920, "inner");
+
+	EXPECT_EQ(cpu.execute(memory, 46, calls), 46);
+	EXPECT_EQ(calls.depth(), 0);
+	EXPECT_EQ(calls.function(CallGraph::ROOT).exclusive, 8);
+	EXPECT_EQ(calls.function(0xA900).calls, 1);
+	EXPECT_EQ(calls.function(0xA900).inclusive, 38);
+	EXPECT_EQ(calls.function(0xA900).exclusive, 22);
+	EXPECT_EQ(calls.function(0xA920).calls, 2);
+	EXPECT_EQ(calls.function(0xA920).inclusive, 16);
+	EXPECT_EQ(calls.edge(0xA900, 0xA920).calls, 2);
+	EXPECT_EQ(calls.edge(0xA900, 0xA920).cycles, 16);
+	EXPECT_EQ(calls.edge(CallGraph::ROOT, 0xA900).cycles, 38);
+
+	std::stringstream dot, trace;
+	calls.write_dot(dot);
+	calls.write_trace(trace);
+	EXPECT_TRUE(dot.str().find("\"outer\" -> \"inner\" [label=\"2 calls\\n16 cycles\"]") != std::string::npos);
+	EXPECT_TRUE(trace.str().find("{\"name\":\"inner\",\"ph\":\"X\",\"ts\":28,\"dur\":8") != std::string::npos);
+}
+
+CFG_TEST(CallGraph_unwinds_dropped_return_addresses) {
+	CPU cpu;
+	Mem memory;
+	CallGraph calls;
+	cpu.reset(memory, 0x1000);
+	// inner drops its return address and returns straight to main, which then
+	// jumps to $A93F by pushing the address and using RTS
+	byte main[] = {
+		CPU::INS_JSR_AB, 0x00, 0xA9, 0x00,
+		CPU::INS_LDA_IM, 0xA9, CPU::INS_PHA, CPU::INS_LDA_IM, 0x3F, CPU::INS_PHA, CPU::INS_RTS,
+	};
+	byte outer[] = { CPU::INS_JSR_AB, 0x20, 0xA9 };
+	byte inner[] = { CPU::INS_PLA, CPU::INS_PLA, CPU::INS_RTS };
+	for (u32 i=0; i<sizeof(main); i++) memory[0x1000 + i] = main[i];
+	for (u32 i=0; i<sizeof(outer); i++) memory[0xA900 + i] = outer[i];
+	for (u32 i=0; i<sizeof(inner); i++) memory[0xA920 + i] = inner[i];
+	memory[0xA93F] = CPU::INS_LDA_IM;
+
+	EXPECT_EQ(cpu.execute(memory, 46, calls), 46);
+	EXPECT_EQ(cpu.PC, 0xA941);
+	EXPECT_EQ(calls.depth(), 0);
+	EXPECT_EQ(calls.function(0xA900).inclusive, 20);
+	EXPECT_EQ(calls.function(0xA920).inclusive, 14);
+	EXPECT_EQ(calls.function(0xA920).exclusive, 14);
+	EXPECT_EQ(calls.function(CallGraph::ROOT).exclusive, 26);
+}
+
+CFG_TEST(CallGraph_follows_a_wrapping_stack_and_escapes_names) {
+	CPU cpu;
+	Mem memory;
+	CallGraph calls;
+	cpu.reset(memory, 0x1000);
+	// the return address goes to $0101/$0100, the callee then runs with SP = $FF
+	cpu.SP = 0x01;
+	byte main[] = { CPU::INS_JSR_AB, 0x00, 0xA9 };
+	byte callee[] = { CPU::INS_TSX, CPU::INS_TXS, CPU::INS_RTS };
+	for (u32 i=0; i<sizeof(main); i++) memory[0x1000 + i] = main[i];
+	for (u32 i=0; i<sizeof(callee); i++) memory[0xA900 + i] = callee[i];
+	calls.symbols.add(0xA900, "say \"hi\" \\o/");
+
+	cpu.execute(memory, 1, calls);
+	EXPECT_EQ(cpu.SP, 0xFF);
+	EXPECT_EQ(calls.depth(), 1);
+	cpu.execute(memory, 1, calls);
+	cpu.execute(memory, 1, calls);
+	EXPECT_EQ(calls.depth(), 1);	// TXS left the return address in place
+	cpu.execute(memory, 1, calls);
+	EXPECT_EQ(cpu.SP, 0x01);
+	EXPECT_EQ(calls.depth(), 0);
+
+	std::stringstream dot, trace;
+	calls.write_dot(dot);
+	calls.write_trace(trace);
+	EXPECT_TRUE(dot.str().find("\t\"say \\\"hi\\\" \\\\o/\" [label=") != std::string::npos);
+	EXPECT_TRUE(trace.str().find("{\"name\":\"say \\\"hi\\\" \\\\o/\",") != std::string::npos);
+}
+
+CFG_TEST(Sampler_records_pc_and_callers) {
+	CPU cpu;
+	Mem memory;
+	cpu.reset(memory, 0x1000);
+	// main calls spin, which loops on LDA #1 / JMP spin
+	byte main[] = { CPU::INS_JSR_AB, 0x00, 0xA9 };
+	byte spin[] = { CPU::INS_LDA_IM, 0x01, CPU::INS_JMP_AB, 0x00, 0xA9 };
+	for (u32 i=0; i<sizeof(main); i++) memory[0x1000 + i] = main[i];
+	for (u32 i=0; i<sizeof(spin); i++) memory[0xA900 + i] = spin[i];
+
+	Sampler sampler;
+	SampleBuffer buffer(4);
+	sampler.attach(cpu, memory, buffer);
+	EXPECT_EQ(cpu.execute(memory, 6 + 5 * 10), 6 + 5 * 10);
+	sampler.tick();
+	EXPECT_EQ(cpu.execute(memory, 5 * 10), 5 * 10);	// a sample costs no cycles
+	for (u32 i=0; i<5; i++) {
+		sampler.tick();
+		cpu.execute(memory, 2);
+	}
+	EXPECT_EQ(buffer.dropped(), 2);
+
+	std::vector<Sample> samples;
+	EXPECT_EQ(buffer.drain(samples), 4);
+	EXPECT_EQ(samples[0].pc, 0xA900);
+	EXPECT_EQ(samples[0].depth, 1);
+	EXPECT_EQ(samples[0].callers[0], 0x1000);
+
+	SampleProfile profile;
+	profile.symbols.add(0x1000, "main");
+	profile.symbols.add(0xA900, "spin");
+	profile.add(samples);
+	EXPECT_EQ(profile.samples(), 4);
+	std::stringstream folded;
+	profile.write_folded(folded);
+	EXPECT_TRUE(folded.str().find("main;spin;spin ") == 0);
+
+	sampler.detach(cpu);
+	EXPECT_TRUE(cpu.samples == nullptr);
+}
+
+CFG_TEST(Sampler_timer_thread_samples_a_running_cpu) {
+	CPU cpu;
+	Mem memory;
+	cpu.reset(memory, 0x1000);
+	byte spin[] = { CPU::INS_LDA_IM, 0x01, CPU::INS_JMP_AB, 0x00, 0x10 };
+	for (u32 i=0; i<sizeof(spin); i++) memory[0x1000 + i] = spin[i];
+
+	Sampler sampler(100);
+	SampleBuffer buffer;
+	sampler.attach(cpu, memory, buffer);
+	sampler.start();
+	std::vector<Sample> samples;
+	u64 used = 0;
+	for (u32 i=0; i<100000 && samples.size() < 3; i++) {
+		used += cpu.execute(memory, 5000);
+		buffer.drain(samples);
+	}
+	sampler.stop();
+	EXPECT_TRUE(samples.size() >= 3);
+	EXPECT_EQ(used % 5, 0);	// the loop is never cut short by a sample
+	for (const Sample& sample : samples) EXPECT_TRUE(sample.pc == 0x1000 || sample.pc == 0x1002);
+}
+
+CFG_TEST(HostCounters_measure_a_run) {
+	CPU cpu;
+	Mem memory;
+	cpu.reset(memory, 0x1000);
+	byte spin[] = { CPU::INS_LDA_IM, 0x01, CPU::INS_JMP_AB, 0x00, 0x10 };
+	for (u32 i=0; i<sizeof(spin); i++) memory[0x1000 + i] = spin[i];
+
+	// counts what it can: without a PMU (in a VM, or not permitted) the run is still measured
+	HostCounters counters;
+	RunCost cost = measure(counters, cpu, memory, 5 * 1000);
+	EXPECT_EQ(cost.guest_cycles, 5 * 1000);
+	EXPECT_EQ(cost.guest_instructions, 2 * 1000);
+	EXPECT_TRUE(cost.host.nanoseconds > 0);
+	for (u32 i=0; i<HostCounters::COUNT; i++) {
+		HostCounters::Counter counter = (HostCounters::Counter)i;
+		if (!counters.available(counter)) {
+			EXPECT_FALSE(cost.host.valid[i]);
+			EXPECT_TRUE(cost.per_instruction(counter) < 0);
+		}
+	}
+	EXPECT_TRUE(counters.any() || !counters.error().empty());
+	std::stringstream report;
+	cost.write(report);
+	EXPECT_TRUE(report.str().find("branch-misses: ") != std::string::npos);
+}
+
+CFG_TEST(OpcodeCost_samples_one_instruction_in_n) {
+	CPU cpu;
+	Mem memory;
+	cpu.reset(memory, 0x1000);
+	byte spin[] = { CPU::INS_LDA_IM, 0x01, CPU::INS_JMP_AB, 0x00, 0x10 };
+	for (u32 i=0; i<sizeof(spin); i++) memory[0x1000 + i] = spin[i];
+
+	HostCounters counters;
+	OpcodeCost cost(counters, 4);
+	counters.start();
+	EXPECT_EQ(cpu.execute(memory, 5 * 100, cost), 5 * 100);
+	counters.stop();
+	// instructions 4, 8, ... are JMPs
+	EXPECT_EQ(cost.at(CPU::INS_JMP_AB).samples, 50);
+	EXPECT_EQ(cost.at(CPU::INS_LDA_IM).samples, 0);
+	std::stringstream report;
+	cost.write(report);
+	EXPECT_TRUE(report.str().find("4C JMP\t50") != std::string::npos);
+}
+
+CFG_TEST(Statistics_counts_instruction_mix) {
+	CPU cpu;
+	Mem memory;
+	Statistics stats;
+	cpu.reset(memory, 0x1000);
+	// LDX #1 / LDA $10FF,X (crosses a page) / PHA / PLA / JSR $A900, which returns
+	// onto LDA #0, then an opcode the CPU does not know
+	byte code[] = {
+		CPU::INS_LDX_IM, 0x01, CPU::INS_LDA_ABX, 0xFF, 0x10, CPU::INS_PHA, CPU::INS_PLA,
+		CPU::INS_JSR_AB, 0x00, 0xA9, 0x00, 0x02,
+	};
+	for (u32 i=0; i<sizeof(code); i++) memory[0x1000 + i] = code[i];
+	memory[0xA900] = CPU::INS_RTS;
+
+	EXPECT_EQ(cpu.execute(memory, 29, stats), 29);
+	Statistics::Snapshot snapshot = stats.snapshot();
+	EXPECT_EQ(snapshot.instructions, 8);
+	EXPECT_EQ(snapshot.cycles, 29);
+	EXPECT_EQ(snapshot.page_crosses, 1);
+	EXPECT_EQ(snapshot.pushes, 3);
+	EXPECT_EQ(snapshot.pulls, 3);
+	EXPECT_EQ(snapshot.unknown, 1);
+	EXPECT_EQ(snapshot.opcodes[CPU::INS_LDA_IM], 1);
+	EXPECT_EQ(snapshot.modes[ABSOLUTE], 1);
+	EXPECT_EQ(snapshot.modes[IMMEDIATE], 2);
+	std::stringstream report;
+	snapshot.write(report);
+	EXPECT_TRUE(report.str().find("page crosses: 1\n") != std::string::npos);
+
+	stats.reset();
+	EXPECT_EQ(stats.snapshot().instructions, 0);
+}
+
+CFG_TEST(Statistics_can_be_read_while_running) {
+	CPU cpu;
+	Mem memory;
+	Statistics stats;
+	cpu.reset(memory, 0x1000);
+	byte spin[] = { CPU::INS_LDA_IM, 0x01, CPU::INS_JMP_AB, 0x00, 0x10 };
+	for (u32 i=0; i<sizeof(spin); i++) memory[0x1000 + i] = spin[i];
+
+	std::atomic<bool> running{true};
+	std::thread machine([&] { while (running) cpu.execute(memory, 5000, stats); });
+	u64 seen = 0;
+	for (u32 i=0; i<100000 && seen < 1000; i++) {
+		u64 now = stats.snapshot().instructions;
+		EXPECT_TRUE(now >= seen);
+		seen = now;
+	}
+	running = false;
+	machine.join();
+	Statistics::Snapshot snapshot = stats.snapshot();
+	EXPECT_EQ(snapshot.cycles, snapshot.instructions / 2 * 5);
+}
+
+CFG_TEST(MemoryHeatmap_counts_accesses_per_page) {
+	CPU cpu;
+	Mem memory;
+	MemoryHeatmap heatmap(true);
+	cpu.reset(memory, 0x1000);
+	// patches the operand of the LDA at $1008 before running it, twice through the JMP
+	byte code[] = {
+		CPU::INS_LDA_IM, 0x05, CPU::INS_STA_AB, 0x09, 0x10, CPU::INS_LDX_ZP, 0x20, CPU::INS_PHA,
+		CPU::INS_LDA_IM, 0x00, CPU::INS_JMP_AB, 0x08, 0x10,
+	};
+	for (u32 i=0; i<sizeof(code); i++) memory[0x1000 + i] = code[i];
+
+	EXPECT_EQ(cpu.execute(memory, 19, heatmap), 19);
+	EXPECT_EQ(cpu.A, 0x05);
+	EXPECT_EQ(heatmap.page(0x10).fetches, 15);
+	EXPECT_EQ(heatmap.page(0x10).writes, 1);
+	EXPECT_EQ(heatmap.page(0x10).fresh, 1);
+	EXPECT_EQ(heatmap.page(0x00).reads, 1);
+	EXPECT_EQ(heatmap.page(0x01).writes, 1);
+	EXPECT_EQ(heatmap.fresh_instructions(), 1);
+	EXPECT_EQ(heatmap.at(0x1009).writes, 1);
+	EXPECT_EQ(heatmap.at(0x1008).fetches, 2);
+	EXPECT_EQ(heatmap.at(0x1008).fresh, 1);
+
+	std::stringstream csv, grid;
+	heatmap.write_csv(csv);
+	heatmap.write_heatmap(grid);
+	EXPECT_TRUE(csv.str().find("\n16,0,1,15,1\n") != std::string::npos);
+	EXPECT_TRUE(grid.str().find("fetches (max 15 per page)\n") != std::string::npos);
+	EXPECT_TRUE(grid.str().find("\n10 @") != std::string::npos);
+}
+
+CFG_TEST(MemoryHeatmap_follows_indirect_addressing) {
+	CPU cpu;
+	Mem memory;
+	MemoryHeatmap heatmap;
+	cpu.reset(memory, 0x1000);
+	// LDY #2 / LDA ($20),Y reads $3002 / STA ($20),Y writes it back
+	byte code[] = { CPU::INS_LDY_IM, 0x02, CPU::INS_LDA_INY, 0x20, CPU::INS_STA_INY, 0x20 };
+	for (u32 i=0; i<sizeof(code); i++) memory[0x1000 + i] = code[i];
+	memory[0x20] = 0x00;
+	memory[0x21] = 0x30;
+
+	EXPECT_EQ(cpu.execute(memory, 12, heatmap), 12);
+	EXPECT_EQ(heatmap.page(0x00).reads, 4);
+	EXPECT_EQ(heatmap.page(0x30).reads, 1);
+	EXPECT_EQ(heatmap.page(0x30).writes, 1);
+	EXPECT_EQ(heatmap.at(0x3002).reads, 0);	// no per byte counts
+	heatmap.reset();
+	EXPECT_EQ(heatmap.page(0x30).reads, 0);
+}